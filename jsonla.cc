@@ -2,612 +2,4115 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <locale.h>
+#include <math.h>
+#include <float.h>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <exception>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSONLA_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(JSONLA_SSE2) && defined(__GNUC__)
+#define JSONLA_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <errno.h>
+#ifdef _WIN32
+#include <stdio.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace ggicci
 {
 using namespace std;
 
+static bool IsDigit(char ch) { return ch >= '0' && ch <= '9'; }
+
+/**
+ * \brief Powers of 10 which are exact in a double.
+ */
+static const double kPowersOf10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * \brief Convert mantissa * 10^exponent to the closest double, when it can be done exactly.
+ *
+ * The Clinger fast path: if both the mantissa and the power of 10 are exact
+ * doubles, one IEEE multiplication or division rounds the result correctly.
+ * Some zeros of a large exponent can be moved into a small mantissa first.
+ * @return false for the hard cases, which need StringToDouble()
+ */
+static bool DecimalToDouble(uint64_t mantissa, int exponent, double& value)
+{
+	const uint64_t kMaxExact = static_cast<uint64_t>(1) << 53;
+	if (0 == exponent) { value = static_cast<double>(mantissa); return true; } // rounded by the cpu
+	if (mantissa > kMaxExact) { return false; }
+	if (exponent < 0)
+	{
+		if (exponent < -22) { return false; }
+		value = static_cast<double>(mantissa) / kPowersOf10[-exponent];
+		return true;
+	}
+	for (; exponent > 22; --exponent)
+	{
+		if (mantissa > kMaxExact / 10) { return false; }
+		mantissa *= 10;
+	}
+	value = static_cast<double>(mantissa) * kPowersOf10[exponent];
+	return true;
+}
+
+/**
+ * \brief Convert the number literal in [begin, end) with strtod, whatever the locale is.
+ */
+static double StringToDouble(const char* begin, const char* end)
+{
+	string literal(begin, end);
+	// strtod expects the decimal point of the current locale
+	const char* point = localeconv()->decimal_point;
+	if (point && strcmp(point, ".") != 0)
+	{
+		string::size_type dot = literal.find('.');
+		if (dot != string::npos) { literal.replace(dot, 1, point); }
+	}
+	return strtod(literal.c_str(), 0);
+}
+
+/* Number formatting */
+
+/**
+ * \brief A floating point number f * 2^e with a 64 bits significand, the "do it yourself" float of Grisu.
+ */
+struct DiyFp
+{
+	uint64_t f;
+	int e;
+
+	DiyFp(uint64_t f, int e) : f(f), e(e) { }
+
+	/**
+	 * \brief The exact value of a positive finite double, not normalized.
+	 */
+	explicit DiyFp(double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		const uint64_t kHiddenBit = static_cast<uint64_t>(1) << 52;
+		int biased = static_cast<int>(bits >> 52) & 0x7FF;
+		f = bits & (kHiddenBit - 1);
+		if (0 != biased) { f += kHiddenBit; e = biased - 1075; }
+		else { e = -1074; } // subnormal
+	}
+
+	DiyFp operator-(const DiyFp& rhs) const { return DiyFp(f - rhs.f, e); }
+
+	/**
+	 * \brief The upper 64 bits of the 128 bits product, rounded.
+	 */
+	DiyFp operator*(const DiyFp& rhs) const
+	{
+		const uint64_t kMask32 = 0xFFFFFFFFu;
+		uint64_t a = f >> 32, b = f & kMask32, c = rhs.f >> 32, d = rhs.f & kMask32;
+		uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+		uint64_t middle = (bd >> 32) + (ad & kMask32) + (bc & kMask32) + (static_cast<uint64_t>(1) << 31);
+		return DiyFp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), e + rhs.e + 64);
+	}
+
+	DiyFp Normalize() const
+	{
+		DiyFp result = *this;
+		while (!(result.f & (static_cast<uint64_t>(1) << 63))) { result.f <<= 1; --result.e; }
+		return result;
+	}
+
+	/**
+	 * \brief The boundaries m- and m+ half way to the neighbour doubles, both with the exponent of m+.
+	 */
+	void Boundaries(DiyFp& minus, DiyFp& plus) const
+	{
+		plus = DiyFp((f << 1) + 1, e - 1).Normalize();
+		// the lower neighbour is closer when f is a power of 2
+		minus = (static_cast<uint64_t>(1) << 52) == f ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+		minus.f <<= minus.e - plus.e;
+		minus.e = plus.e;
+	}
+};
+
+/**
+ * \brief Normalized 10^k for k = -348, -340, ..., 340, rounded to 64 bits.
+ */
+static const struct { uint64_t f; int e; } kCachedPowers[] =
+{
+	{ 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 },
+	{ 0xcf42894a5dce35eaULL, -1140 }, { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+	{ 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 }, { 0xbe5691ef416bd60cULL, -1007 },
+	{ 0x8dd01fad907ffc3cULL, -980 }, { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+	{ 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 }, { 0x823c12795db6ce57ULL, -847 },
+	{ 0xc21094364dfb5637ULL, -821 }, { 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 },
+	{ 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 }, { 0xb23867fb2a35b28eULL, -688 },
+	{ 0x84c8d4dfd2c63f3bULL, -661 }, { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+	{ 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 }, { 0xf3e2f893dec3f126ULL, -529 },
+	{ 0xb5b5ada8aaff80b8ULL, -502 }, { 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 },
+	{ 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 }, { 0xa6dfbd9fb8e5b88fULL, -369 },
+	{ 0xf8a95fcf88747d94ULL, -343 }, { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+	{ 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 }, { 0xe45c10c42a2b3b06ULL, -210 },
+	{ 0xaa242499697392d3ULL, -183 }, { 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 },
+	{ 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 }, { 0x9c40000000000000ULL, -50 },
+	{ 0xe8d4a51000000000ULL, -24 }, { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+	{ 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 }, { 0xd5d238a4abe98068ULL, 109 },
+	{ 0x9f4f2726179a2245ULL, 136 }, { 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 },
+	{ 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 }, { 0x924d692ca61be758ULL, 269 },
+	{ 0xda01ee641a708deaULL, 295 }, { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+	{ 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 }, { 0xc83553c5c8965d3dULL, 428 },
+	{ 0x952ab45cfa97a0b3ULL, 455 }, { 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 },
+	{ 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 }, { 0x88fcf317f22241e2ULL, 588 },
+	{ 0xcc20ce9bd35c78a5ULL, 614 }, { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+	{ 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 }, { 0xbb764c4ca7a44410ULL, 747 },
+	{ 0x8bab8eefb6409c1aULL, 774 }, { 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 },
+	{ 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 }, { 0x80444b5e7aa7cf85ULL, 907 },
+	{ 0xbf21e44003acdd2dULL, 933 }, { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+	{ 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 }, { 0xaf87023b9bf0ee6bULL, 1066 }
+};
+
+/**
+ * \brief A cached power c = 10^-k which brings the product of a DiyFp with exponent \em e into [2^-60, 2^-32].
+ */
+static DiyFp CachedPower(int e, int& k)
+{
+	double dk = (-61 - e) * 0.30102999566398114 + 347; // log10(2), positive to take the ceiling
+	int ceiling = static_cast<int>(dk);
+	if (dk - ceiling > 0.0) { ++ceiling; }
+	unsigned index = static_cast<unsigned>((ceiling >> 3) + 1);
+	k = -(-348 + static_cast<int>(index << 3));
+	return DiyFp(kCachedPowers[index].f, kCachedPowers[index].e);
+}
+
+static const uint64_t kIntegerPowersOf10[] =
+{
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+	1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+	1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/**
+ * \brief Move the last digit towards \em w while it stays in the unsafe interval.
+ *
+ * All the distances are in units of the last digit times ten_kappa. The
+ * products of Grisu are off by up to one \em unit, so the digits are only
+ * returned when they are the closest and inside the interval for sure.
+ * @return false when the shortest closest digits cannot be proven
+ */
+static bool RoundWeed(char* digits, int size, uint64_t distance_too_high_w, uint64_t unsafe_interval,
+	uint64_t rest, uint64_t ten_kappa, uint64_t unit)
+{
+	uint64_t small_distance = distance_too_high_w - unit;
+	uint64_t big_distance = distance_too_high_w + unit;
+	while (rest < small_distance && unsafe_interval - rest >= ten_kappa
+		&& (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance))
+	{
+		--digits[size - 1];
+		rest += ten_kappa;
+	}
+	if (rest < big_distance && unsafe_interval - rest >= ten_kappa
+		&& (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance))
+	{
+		return false;
+	}
+	return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/**
+ * \brief Generate the shortest digits in (low, high) which are the closest to \em w.
+ *
+ * The three of them are scaled by the same cached power, with an exponent in [-60, -32].
+ */
+static bool GrisuDigits(const DiyFp& low, const DiyFp& w, const DiyFp& high, char* digits, int& size, int& kappa)
+{
+	uint64_t unit = 1;
+	const DiyFp too_low(low.f - unit, low.e);
+	const DiyFp too_high(high.f + unit, high.e);
+	uint64_t unsafe_interval = (too_high - too_low).f;
+	const DiyFp one(static_cast<uint64_t>(1) << -w.e, w.e);
+	uint32_t integrals = static_cast<uint32_t>(too_high.f >> -one.e);
+	uint64_t fractionals = too_high.f & (one.f - 1);
+	kappa = 1;
+	while (kappa < 10 && integrals >= kIntegerPowersOf10[kappa]) { ++kappa; }
+	size = 0;
+	while (kappa > 0)
+	{
+		uint32_t divisor = static_cast<uint32_t>(kIntegerPowersOf10[--kappa]);
+		uint32_t digit = integrals / divisor;
+		integrals %= divisor;
+		if (digit || size) { digits[size++] = static_cast<char>('0' + digit); }
+		uint64_t rest = (static_cast<uint64_t>(integrals) << -one.e) + fractionals;
+		if (rest < unsafe_interval)
+		{
+			return RoundWeed(digits, size, (too_high - w).f, unsafe_interval, rest,
+				static_cast<uint64_t>(divisor) << -one.e, unit);
+		}
+	}
+	for (;;)
+	{
+		fractionals *= 10;
+		unit *= 10;
+		unsafe_interval *= 10;
+		char digit = static_cast<char>(fractionals >> -one.e);
+		if (digit || size) { digits[size++] = static_cast<char>('0' + digit); }
+		fractionals &= one.f - 1;
+		--kappa;
+		if (fractionals < unsafe_interval)
+		{
+			return RoundWeed(digits, size, (too_high - w).f * unit, unsafe_interval, fractionals, one.f, unit);
+		}
+	}
+}
+
+/**
+ * \brief Grisu3: the shortest digits of a positive finite double, value ~ digits * 10^k.
+ * @return false for the about 0.5% of the doubles it cannot prove the digits of
+ */
+static bool Grisu3(double value, char* digits, int& size, int& k)
+{
+	const DiyFp v(value);
+	DiyFp minus(0, 0), plus(0, 0);
+	v.Boundaries(minus, plus);
+	int mk = 0;
+	const DiyFp c_mk = CachedPower(plus.e, mk);
+	int kappa = 0;
+	bool proven = GrisuDigits(minus * c_mk, v.Normalize() * c_mk, plus * c_mk, digits, size, kappa);
+	k = mk + kappa;
+	return proven;
+}
+
+/**
+ * \brief The fallback of Grisu3: the correctly rounded digits of increasing precisions until one reads back.
+ *
+ * No decimal point is written nor read, so the locale does not matter.
+ */
+static void ShortestDigits(double value, char* digits, int& size, int& k)
+{
+	char text[40], literal[40];
+	for (int precision = 1; precision <= 17; ++precision)
+	{
+		snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+		size = 0;
+		const char* p = text;
+		for (; 'e' != *p; ++p) { if (IsDigit(*p)) { digits[size++] = *p; } }
+		k = atoi(p + 1) - (size - 1);
+		memcpy(literal, digits, size);
+		snprintf(literal + size, sizeof(literal) - size, "e%d", k);
+		if (strtod(literal, 0) == value) { break; }
+	}
+	while (size > 1 && '0' == digits[size - 1]) { --size; ++k; }
+}
+
+/**
+ * \brief Write the decimal digits of \em number at \em out.
+ * @return the end of the digits
+ */
+static char* FormatInteger(uint64_t number, char* out)
+{
+	char reversed[20];
+	int size = 0;
+	do { reversed[size++] = static_cast<char>('0' + number % 10); number /= 10; } while (number);
+	while (size) { *out++ = reversed[--size]; }
+	return out;
+}
+
+/**
+ * \brief Place the decimal point of digits * 10^k, or an exponent when it is far away.
+ * @return the end of the number
+ */
+static char* FormatDecimal(char* digits, int size, int k)
+{
+	const int point = size + k; // 10^(point - 1) <= value < 10^point
+	if (0 <= k && point <= 21)
+	{
+		// 1234e5 -> 123400000
+		memset(digits + size, '0', k);
+		return digits + point;
+	}
+	if (0 < point && point <= 21)
+	{
+		// 1234e-2 -> 12.34
+		memmove(digits + point + 1, digits + point, size - point);
+		digits[point] = '.';
+		return digits + size + 1;
+	}
+	if (-6 < point && point <= 0)
+	{
+		// 1234e-6 -> 0.001234
+		const int offset = 2 - point;
+		memmove(digits + offset, digits, size);
+		digits[0] = '0';
+		digits[1] = '.';
+		memset(digits + 2, '0', offset - 2);
+		return digits + size + offset;
+	}
+	// 1234e30 -> 1.234e33, 1e30 stays
+	char* out = digits + 1;
+	if (size > 1)
+	{
+		memmove(digits + 2, digits + 1, size - 1);
+		digits[1] = '.';
+		out = digits + size + 1;
+	}
+	*out++ = 'e';
+	int exponent = point - 1;
+	if (exponent < 0) { *out++ = '-'; exponent = -exponent; }
+	return FormatInteger(static_cast<uint64_t>(exponent), out);
+}
+
+/**
+ * \brief Write the shortest text which reads back as \em number, without the locale.
+ *
+ * Integral values below 2^53 are written as integers directly, the others go
+ * through Grisu3, or its fallback when it fails. JSON has no infinities nor
+ * NaN, they are written as null.
+ * @param out room for at least 32 characters
+ * @return the end of the text
+ */
+static char* FormatDouble(double number, char* out)
+{
+	if (number != number || number - number != 0) // NaN or infinite
+	{
+		memcpy(out, "null", 4);
+		return out + 4;
+	}
+	if (signbit(number)) { *out++ = '-'; number = -number; }
+	const double kMaxExact = 9007199254740992.0; // 2^53
+	if (number < kMaxExact && static_cast<double>(static_cast<uint64_t>(number)) == number)
+	{
+		return FormatInteger(static_cast<uint64_t>(number), out);
+	}
+	int size = 0, k = 0;
+	if (!Grisu3(number, out, size, k)) { ShortestDigits(number, out, size, k); }
+	return FormatDecimal(out, size, k);
+}
+
+/* Scanning kernels */
+static inline bool IsSpace(char ch) { return ' ' == ch || '\t' == ch || '\n' == ch || '\r' == ch; }
+
+/**
+ * \brief Whether \em ch ends the plain characters of a string: a quote, an escape or a control.
+ */
+static inline bool IsStringSpecial(unsigned char ch)
+{
+	return '\"' == ch || '\\' == ch || ch < 0x20 || 0x7F == ch;
+}
+
+/**
+ * \brief A scanning kernel, returns the first byte of [p, end) it stops at, or \em end.
+ */
+typedef const char* (*Scanner)(const char* p, const char* end);
+
+static const char* SkipSpacesScalar(const char* p, const char* end)
+{
+	while (p != end && IsSpace(*p)) { ++p; }
+	return p;
+}
+
+static const char* FindStringSpecialScalar(const char* p, const char* end)
+{
+	while (p != end && !IsStringSpecial(*p)) { ++p; }
+	return p;
+}
+
+static inline unsigned CountTrailingZeros(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#ifdef JSONLA_SSE2
+static const char* SkipSpacesSse2(const char* p, const char* end)
+{
+	const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+		unsigned mask = ~_mm_movemask_epi8(ws) & 0xFFFF;
+		if (mask) { return p + CountTrailingZeros(mask); }
+	}
+	return SkipSpacesScalar(p, end);
+}
+
+static const char* FindStringSpecialSse2(const char* p, const char* end)
+{
+	const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F), del = _mm_set1_epi8(0x7F);
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		// x <= 0x1F (unsigned) is max(x, 0x1F) == 0x1F
+		__m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+			_mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, control), control), _mm_cmpeq_epi8(x, del)));
+		unsigned mask = _mm_movemask_epi8(special);
+		if (mask) { return p + CountTrailingZeros(mask); }
+	}
+	return FindStringSpecialScalar(p, end);
+}
+#endif // JSONLA_SSE2
+
+#ifdef JSONLA_AVX2
+__attribute__((target("avx2")))
+static const char* SkipSpacesAvx2(const char* p, const char* end)
+{
+	const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+	const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+	for (; end - p >= 32; p += 32)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, space), _mm256_cmpeq_epi8(x, tab)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, lf), _mm256_cmpeq_epi8(x, cr)));
+		unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+		if (mask) { return p + CountTrailingZeros(mask); }
+	}
+	return SkipSpacesSse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* FindStringSpecialAvx2(const char* p, const char* end)
+{
+	const __m256i quote = _mm256_set1_epi8('\"'), backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1F), del = _mm256_set1_epi8(0x7F);
+	for (; end - p >= 32; p += 32)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, backslash)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, control), control),
+				_mm256_cmpeq_epi8(x, del)));
+		unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special));
+		if (mask) { return p + CountTrailingZeros(mask); }
+	}
+	return FindStringSpecialSse2(p, end);
+}
+#endif // JSONLA_AVX2
+
+/**
+ * \brief Bitmasks of a 64-byte block, bit i is set if byte i is one of the class.
+ */
+struct BlockMasks
+{
+	uint64_t backslash;	///< '\\'
+	uint64_t quote;		///< '"'
+	uint64_t space;		///< ' ', '\t', '\n', '\r'
+	uint64_t op;		///< '{', '}', '[', ']', ':', ','
+};
+
+/**
+ * \brief A classifying kernel, fill \em masks for the 64 bytes at \em block.
+ */
+typedef void (*Classifier)(const char* block, BlockMasks& masks);
+
+static inline bool IsOperator(char ch)
+{
+	return '{' == ch || '}' == ch || '[' == ch || ']' == ch || ':' == ch || ',' == ch;
+}
+
+static void ClassifyScalar(const char* block, BlockMasks& masks)
+{
+	masks.backslash = masks.quote = masks.space = masks.op = 0;
+	for (int i = 0; i < 64; ++i)
+	{
+		uint64_t bit = static_cast<uint64_t>(1) << i;
+		char ch = block[i];
+		if ('\\' == ch) { masks.backslash |= bit; }
+		else if ('\"' == ch) { masks.quote |= bit; }
+		else if (IsSpace(ch)) { masks.space |= bit; }
+		else if (IsOperator(ch)) { masks.op |= bit; }
+	}
+}
+
+#ifdef JSONLA_SSE2
+static void ClassifySse2(const char* block, BlockMasks& masks)
+{
+	const __m128i backslash = _mm_set1_epi8('\\'), quote = _mm_set1_epi8('\"');
+	const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+	const __m128i lower = _mm_set1_epi8(0x20), brace_open = _mm_set1_epi8('{');
+	const __m128i brace_close = _mm_set1_epi8('}'), colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+	masks.backslash = masks.quote = masks.space = masks.op = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+		// '[' | 0x20 == '{' and ']' | 0x20 == '}'
+		__m128i folded = _mm_or_si128(x, lower);
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+		__m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, brace_open), _mm_cmpeq_epi8(folded, brace_close)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, colon), _mm_cmpeq_epi8(x, comma)));
+		int shift = 16 * i;
+		masks.backslash |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, backslash))) << shift;
+		masks.quote |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, quote))) << shift;
+		masks.space |= static_cast<uint64_t>(_mm_movemask_epi8(ws)) << shift;
+		masks.op |= static_cast<uint64_t>(_mm_movemask_epi8(op)) << shift;
+	}
+}
+#endif // JSONLA_SSE2
+
+#ifdef JSONLA_AVX2
+__attribute__((target("avx2")))
+static void ClassifyAvx2(const char* block, BlockMasks& masks)
+{
+	const __m256i backslash = _mm256_set1_epi8('\\'), quote = _mm256_set1_epi8('\"');
+	const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+	const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+	const __m256i lower = _mm256_set1_epi8(0x20), brace_open = _mm256_set1_epi8('{');
+	const __m256i brace_close = _mm256_set1_epi8('}'), colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	masks.backslash = masks.quote = masks.space = masks.op = 0;
+	for (int i = 0; i < 2; ++i)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));
+		__m256i folded = _mm256_or_si256(x, lower);
+		__m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, space), _mm256_cmpeq_epi8(x, tab)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, lf), _mm256_cmpeq_epi8(x, cr)));
+		__m256i op = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(folded, brace_open), _mm256_cmpeq_epi8(folded, brace_close)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, colon), _mm256_cmpeq_epi8(x, comma)));
+		int shift = 32 * i;
+		masks.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, backslash)))) << shift;
+		masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, quote)))) << shift;
+		masks.space |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << shift;
+		masks.op |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << shift;
+	}
+}
+#endif // JSONLA_AVX2
+
+static const char* SkipSpacesResolve(const char* p, const char* end);
+static const char* FindStringSpecialResolve(const char* p, const char* end);
+static void ClassifyResolve(const char* block, BlockMasks& masks);
+
+/**
+ * \brief The kernels in use, chosen for the cpu at the first call.
+ */
+static atomic<Scanner> g_skip_spaces(SkipSpacesResolve);
+static atomic<Scanner> g_find_string_special(FindStringSpecialResolve);
+static atomic<Classifier> g_classify(ClassifyResolve);
+
+static void ChooseScanners()
+{
+	Scanner skip_spaces = SkipSpacesScalar;
+	Scanner find_string_special = FindStringSpecialScalar;
+	Classifier classify = ClassifyScalar;
+#ifdef JSONLA_SSE2
+	skip_spaces = SkipSpacesSse2;
+	find_string_special = FindStringSpecialSse2;
+	classify = ClassifySse2;
+#endif
+#ifdef JSONLA_AVX2
+	if (__builtin_cpu_supports("avx2"))
+	{
+		skip_spaces = SkipSpacesAvx2;
+		find_string_special = FindStringSpecialAvx2;
+		classify = ClassifyAvx2;
+	}
+#endif
+	g_skip_spaces.store(skip_spaces, memory_order_relaxed);
+	g_find_string_special.store(find_string_special, memory_order_relaxed);
+	g_classify.store(classify, memory_order_relaxed);
+}
+
+static const char* SkipSpacesResolve(const char* p, const char* end)
+{
+	ChooseScanners();
+	return g_skip_spaces.load(memory_order_relaxed)(p, end);
+}
+
+static const char* FindStringSpecialResolve(const char* p, const char* end)
+{
+	ChooseScanners();
+	return g_find_string_special.load(memory_order_relaxed)(p, end);
+}
+
+static void ClassifyResolve(const char* block, BlockMasks& masks)
+{
+	ChooseScanners();
+	g_classify.load(memory_order_relaxed)(block, masks);
+}
+
+static inline unsigned CountTrailingZeros64(uint64_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+/**
+ * \brief Bit i of the result is the xor of the bits 0..i of \em mask.
+ *
+ * Applied to the quotes of a block, it turns on the bits from each opening
+ * quote up to (not including) its closing quote.
+ */
+static inline uint64_t PrefixXor(uint64_t mask)
+{
+	mask ^= mask << 1;
+	mask ^= mask << 2;
+	mask ^= mask << 4;
+	mask ^= mask << 8;
+	mask ^= mask << 16;
+	mask ^= mask << 32;
+	return mask;
+}
+
+static unsigned HexValue(char ch)
+{
+	if (ch >= '0' && ch <= '9') { return ch - '0'; }
+	return (ch | 0x20) - 'a' + 10;
+}
+
+/**
+ * \brief Append the UTF-8 encoding of the code point \em code to \em out.
+ * \note A lone surrogate is encoded as it is (3 bytes), like the other code points.
+ */
+static void AppendUtf8(string& out, unsigned code)
+{
+	if (code < 0x80) { out += static_cast<char>(code); }
+	else if (code < 0x800)
+	{
+		out += static_cast<char>(0xC0 | (code >> 6));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		out += static_cast<char>(0xE0 | (code >> 12));
+		out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		out += static_cast<char>(0xF0 | (code >> 18));
+		out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+		out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+		out += static_cast<char>(0x80 | (code & 0x3F));
+	}
+}
+
+/**
+ * \brief FNV-1a hash of the characters of a key.
+ */
+static inline uint32_t HashKey(const char* key, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; ++i) { hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u; }
+	return hash;
+}
+
+/**
+ * \brief The handler building Json objects from the events of a Parser.
+ *
+ * Every value is put in its container as soon as it starts, so the tree is
+ * always whole: after a syntax error, deleting the root frees everything
+ * (and nothing needs to be freed with an arena).
+ */
+class Json::Builder
+{
+public:
+	/**
+	 * \brief Build from the events of \em parser into \em arena (or the heap).
+	 */
+	Builder(const Parser& parser, Arena* arena)
+		: source_(parser.source), end_(parser.end), flags_(parser.flags), arena_(arena), root_(0) { }
+
+	/**
+	 * \brief Build from the events of a decoder of [source, end) into \em arena (or the heap).
+	 */
+	Builder(const char* source, const char* end, unsigned flags, Arena* arena)
+		: source_(source), end_(end), flags_(flags), arena_(arena), root_(0) { }
+
+	/**
+	 * \brief Build from events with no source to view into \em arena (or the heap).
+	 */
+	explicit Builder(Arena* arena) : source_(0), end_(0), flags_(kParseDefault), arena_(arena), root_(0) { }
+
+	/**
+	 * \brief Delete the values not released, on the heap.
+	 */
+	~Builder()
+	{
+		// arena strings are not freed one by one, forget a pending key
+		if (arena_) { key_.kind_ = kNull; return; }
+		delete root_;
+		for (size_t i = 0; i < dropped_.size(); ++i) { delete dropped_[i]; }
+	}
+
+	/**
+	 * \brief Take the root value, the Builder forgets it.
+	 */
+	Json* Release() { Json* root = root_; root_ = 0; return root; }
+
+	bool Null() { Add(); return true; }
+	bool Bool(bool boolean) { Json* json = Add(); json->kind_ = kBool; json->value_.boolean = boolean; return true; }
+	bool Number(double number) { SetNumber(kDouble)->value_.number = number; return true; }
+	bool Int64(int64_t integer) { SetNumber(kInt64)->value_.integer = integer; return true; }
+	bool UInt64(uint64_t integer) { SetNumber(kUInt64)->value_.unsigned_integer = integer; return true; }
+	bool String(const char* str, size_t size) { StoreText(*Add(), str, size); return true; }
+	bool Key(const char* str, size_t size)
+	{
+		if ((flags_ & kParseInternKeys) && size > kInlineCapacity) { key_.SetInterned(Intern(str, size, HashKey(str, size)), size); }
+		else { StoreText(key_, str, size); }
+		return true;
+	}
+	bool StartObject()
+	{
+		Json* json = Add();
+		json->kind_ = kObject;
+		json->value_.object = Make(ObjectData(ObjectData::allocator_type(arena_)));
+		// a copy must not share views into the source
+		json->value_.object->refs.borrowed.store(0 != (flags_ & kParseStringViews), std::memory_order_relaxed);
+		stack_.push_back(json);
+		return true;
+	}
+	bool StartObject(size_t size) { StartObject(); stack_.back()->value_.object->reserve(size); return true; }
+	bool EndObject() { stack_.pop_back(); return true; }
+	bool StartArray()
+	{
+		Json* json = Add();
+		json->kind_ = kArray;
+		json->value_.array = Make(ArrayData(ArrayData::allocator_type(arena_)));
+		json->value_.array->refs.borrowed.store(0 != (flags_ & kParseStringViews), std::memory_order_relaxed);
+		stack_.push_back(json);
+		return true;
+	}
+	bool StartArray(size_t size) { StartArray(); stack_.back()->value_.array->reserve(size); return true; }
+	bool EndArray() { stack_.pop_back(); return true; }
+
+private:
+	Builder(const Builder&);
+	Builder& operator = (const Builder&);
+
+	/**
+	 * \brief Put a null Json object in the open container.
+	 *
+	 * The values are stored in their container, the open containers do not
+	 * move since their parent gets no value until they are closed.
+	 * \note The first one wins if a key appears twice, the later values are dropped.
+	 */
+	Json* Add()
+	{
+		if (stack_.empty()) { return root_ = Make(Json()); }
+		Json& parent = *stack_.back();
+		if (parent.IsArray())
+		{
+			parent.value_.array->push_back(Json());
+			return &parent.value_.array->back();
+		}
+		bool inserted = false;
+		Json& value = parent.value_.object->Insert(std::move(key_), inserted);
+		if (inserted) { return &value; }
+		Json* json = Make(Json());
+		if (!arena_)
+		{
+			key_ = Json();
+			dropped_.push_back(json);
+		}
+		return json;
+	}
+
+	/**
+	 * \brief Put a number Json object of \em type in the open container, its value is left to set.
+	 */
+	Json* SetNumber(NumberType type)
+	{
+		Json* json = Add();
+		json->kind_ = kNumber;
+		json->storage_ = type;
+		return json;
+	}
+
+	/**
+	 * \brief Store \em str into the (null) string Json object \em json.
+	 *
+	 * Referenced as a view with kParseStringViews if \em str is in the source,
+	 * otherwise copied into the arena (or the heap).
+	 */
+	void StoreText(Json& json, const char* str, size_t size)
+	{
+		if ((flags_ & kParseStringViews) && str >= source_ && str < end_) { json.SetView(str, size); }
+		else { json.SetString(str, size, arena_); }
+	}
+
+	/**
+	 * \brief Move \em value into memory allocated from the arena (or the heap).
+	 * \note Containers and strings keep the allocator they were built with.
+	 */
+	template <typename T>
+	T* Make(T value)
+	{
+		void* p = arena_ ? arena_->Allocate(sizeof(T), alignof(T)) : ::operator new(sizeof(T));
+		return new (p) T(std::move(value));
+	}
+
+	const char* source_;		///< the parsed source, strings in it may be viewed
+	const char* end_;			///< the end of \em source_
+	unsigned flags_;			///< ParseFlag values
+	Arena* arena_;				///< where the values are allocated, null for the heap
+	Json* root_;				///< the first value, it owns all the values put in containers
+	Json key_;					///< the key of the next value of an object
+	vector<Json*> stack_;		///< the open containers
+	vector<Json*> dropped_;		///< the heap values of duplicate keys, deleted at the end
+};
+
 /* Json */
 Json Json::Parse(const char* json_string)
 {
-	Parser parser(json_string);
-	Json *json = parser.ConsumeValue(false);
-	Json retval(json);
-	delete json;
-	return retval;
+	return Parse(json_string, kParseDefault);
+}
+
+Json Json::Parse(const char* json_string, ParseFlag flags)
+{
+	return Parse(json_string, strlen(json_string), flags);
+}
+
+Json Json::Parse(const char* data, size_t size, ParseFlag flags)
+{
+	Parser parser(data, size, flags);
+	Builder builder(parser, 0);
+	parser.ParseDocument(builder);
+	Json *json = builder.Release();
+	Json retval(std::move(*json));
+	delete json;
+	return retval;
+}
+
+/**
+ * \brief A whole file mapped in memory (or read, where there is no mmap).
+ */
+struct MappedFile
+{
+	MappedFile() : data(""), size(0) { }
+	~MappedFile();
+
+	/**
+	 * \brief Map the file at \em path.
+	 * @return false with errno set on failure
+	 */
+	bool Open(const char* path);
+
+	const char* data;			///< the characters of the file
+	size_t size;				///< number of characters
+#ifdef _WIN32
+	std::vector<char> buffer;	///< where the file is read
+#endif
+};
+
+#ifdef _WIN32
+MappedFile::~MappedFile() { }
+
+bool MappedFile::Open(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) { return false; }
+	char chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) { buffer.insert(buffer.end(), chunk, chunk + n); }
+	fclose(file);
+	data = buffer.empty() ? "" : &buffer[0];
+	size = buffer.size();
+	return true;
+}
+#else
+MappedFile::~MappedFile()
+{
+	if (size > 0) { munmap(const_cast<char*>(data), size); }
+}
+
+bool MappedFile::Open(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) { return false; }
+	struct stat st;
+	if (fstat(fd, &st) != 0) { int error = errno; close(fd); errno = error; return false; }
+	if (st.st_size > 0)
+	{
+		void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (MAP_FAILED == p) { int error = errno; close(fd); errno = error; return false; }
+#ifdef MADV_SEQUENTIAL
+		madvise(p, st.st_size, MADV_SEQUENTIAL);
+#endif
+		data = static_cast<const char*>(p);
+		size = st.st_size;
+	}
+	close(fd); // the mapping stays
+	return true;
+}
+#endif
+
+Json Json::ParseFile(const char* path, ParseFlag flags)
+{
+	MappedFile file;
+	if (!file.Open(path)) { throw FileException(path, errno); }
+	// nothing may point into the mapping, it is gone at return
+	return Parse(file.data, file.size, static_cast<ParseFlag>(flags & ~kParseStringViews));
+}
+
+Json::Json() : kind_(kNull), storage_(kInline), size_(0), value_() { }
+Json::Json(int num) : kind_(kNumber), storage_(kInt64), size_(0) { value_.integer = num; }
+Json::Json(int64_t num) : kind_(kNumber), storage_(kInt64), size_(0) { value_.integer = num; }
+Json::Json(uint64_t num) : kind_(kNumber), storage_(kInt64), size_(0)
+{
+	if (num > static_cast<uint64_t>(INT64_MAX)) { storage_ = kUInt64; value_.unsigned_integer = num; }
+	else { value_.integer = static_cast<int64_t>(num); }
+}
+Json::Json(double num) : kind_(kNumber), storage_(kDouble), size_(0) { value_.number = num; }
+Json::Json(bool boo) : kind_(kBool), storage_(kInline), size_(0) { value_.boolean = boo; }
+
+Json::Json(const string& str) : kind_(kNull), storage_(kInline), size_(0)
+{
+	SetString(str.data(), str.size());
+}
+
+Json::Json(const char* str) : kind_(kNull), storage_(kInline), size_(0)
+{
+	SetString(str, strlen(str));
+}
+
+Json::Json(const Json& rhs) : kind_(kNull), storage_(kInline), size_(0)
+{
+	TRACK("Json::Json(const Json& rhs)");
+	DoCopy(rhs);
+}
+
+Json& Json::operator = (const Json& rhs)
+{
+	TRACK("Json& Json::operator = (const Json& rhs)");
+	if (this == &rhs) { return *this; }
+	// copy first, rhs may live inside this Json object
+	Json tmp(rhs);
+	Swap(tmp);
+	return *this;
+}
+
+Json::Json(Json&& rhs) noexcept
+	: kind_(rhs.kind_), storage_(rhs.storage_), size_(rhs.size_), value_(rhs.value_)
+{
+	TRACK("Json::Json(Json&& rhs)");
+	rhs.kind_ = kNull;
+	rhs.storage_ = kInline;
+}
+
+Json& Json::operator = (Json&& rhs) noexcept
+{
+	TRACK("Json& Json::operator = (Json&& rhs)");
+	if (this == &rhs) { return *this; }
+	// steal first, rhs may live inside this Json object
+	Json tmp(std::move(rhs));
+	Swap(tmp);
+	return *this;
+}
+
+void Json::Swap(Json& rhs) noexcept
+{
+	std::swap(kind_, rhs.kind_);
+	std::swap(storage_, rhs.storage_);
+	std::swap(size_, rhs.size_);
+	std::swap(value_, rhs.value_);
+}
+
+
+/**
+ * \brief Whether \em data may be shared at all: on the heap and not borrowed.
+ */
+template <typename Data>
+static inline bool Shareable(const Data& data)
+{
+	return !data.get_allocator().arena && !data.refs.borrowed.load(std::memory_order_relaxed);
+}
+
+bool Json::Settled(const Json& json)
+{
+	switch (json.kind_)
+	{
+		case kString: return kView != json.storage_ && kAllocated != json.storage_;
+		case kArray:
+		{
+			ArrayData& data = *json.value_.array;
+			if (!Shareable(data)) { return false; }
+			if (!data.refs.exposed.load(std::memory_order_relaxed)) { return true; }
+			for (ArrayData::const_iterator it = data.begin(); it != data.end(); ++it)
+			{
+				if (!Settled(*it)) { return false; }
+			}
+			data.refs.exposed.store(false, std::memory_order_relaxed);
+			return true;
+		}
+		case kObject:
+		{
+			ObjectData& data = *json.value_.object;
+			if (!Shareable(data)) { return false; }
+			if (!data.refs.exposed.load(std::memory_order_relaxed)) { return true; }
+			// the keys can not be written through a reference, only the values
+			for (ObjectData::const_iterator it = data.begin(); it != data.end(); ++it)
+			{
+				if (!Settled(it->value)) { return false; }
+			}
+			data.refs.exposed.store(false, std::memory_order_relaxed);
+			return true;
+		}
+		default: return true;
+	}
+}
+
+void Json::DoCopy(const Json& rhs)
+{
+	TRACK("void Json::DoCopy(const Json& rhs)");
+	switch (rhs.kind_)
+	{
+		case kNull: case kNumber: case kBool:
+		{
+			kind_ = rhs.kind_;
+			storage_ = rhs.storage_;
+			value_ = rhs.value_;
+			break;
+		}
+		case kString:
+		{
+			// interned keys are shared, they are never freed
+			if (kInterned == rhs.storage_) { SetInterned(rhs.value_.text.data, rhs.value_.text.size); }
+			else if (kShared == rhs.storage_)
+			{
+				SharedRefs(rhs.value_.text.data).AddRef();
+				kind_ = kString;
+				storage_ = kShared;
+				value_.text = rhs.value_.text;
+			}
+			else { SetString(rhs.StringData(), rhs.StringSize()); }
+			break;
+		}
+		// the others are copied one level deep onto the heap (see ArenaAllocator),
+		// the copies of the elements and members share what they can
+		case kArray:
+		{
+			if (Settled(rhs))
+			{
+				rhs.value_.array->refs.AddRef();
+				value_.array = rhs.value_.array;
+			}
+			else { value_.array = new ArrayData(*rhs.value_.array); }
+			kind_ = kArray;
+			break;
+		}
+		case kObject:
+		{
+			if (Settled(rhs))
+			{
+				rhs.value_.object->refs.AddRef();
+				value_.object = rhs.value_.object;
+			}
+			else { value_.object = new ObjectData(*rhs.value_.object); }
+			kind_ = kObject;
+			break;
+		}
+		default: break;
+	}
+}
+
+void Json::Adopt(Json& value)
+{
+	Arena* arena = (kArray == kind_) ? value_.array->get_allocator().arena : value_.object->get_allocator().arena;
+	if (arena || Settled(value)) { return; }
+	Json copy(value);
+	value.Swap(copy);
+}
+
+void Json::Release()
+{
+	TRACK("void Json::Release()");
+	TRACK("----------------------------------- Delete[" << kind_ << "]: " << ToString());
+	switch (kind_)
+	{
+		// arena strings and containers are freed with their arena, they are never released
+		case kString:
+		{
+			if (kShared == storage_ && SharedRefs(value_.text.data).DropRef())
+			{
+				::operator delete(&SharedRefs(value_.text.data));
+			}
+			break;
+		}
+		case kObject:
+		{
+			if (value_.object->refs.DropRef()) { delete value_.object; }
+			break;
+		}
+		case kArray:
+		{
+			if (value_.array->refs.DropRef()) { delete value_.array; }
+			break;
+		}
+		default: break;
+	}
+	kind_ = kNull;
+	storage_ = kInline;
+}
+
+Json::~Json()
+{
+	TRACK("~Json");
+	Release();
+}
+
+void Json::SetString(const char* str, size_t size, Arena* arena/* = 0 */)
+{
+	kind_ = kString;
+	if (size <= kInlineCapacity)
+	{
+		storage_ = kInline;
+		size_ = static_cast<unsigned char>(size);
+		memcpy(value_.chars, str, size);
+		value_.chars[size] = '\0';
+		return;
+	}
+	char* data = 0;
+	if (arena)
+	{
+		data = static_cast<char*>(arena->Allocate(size + 1, 1));
+		storage_ = kAllocated;
+	}
+	else
+	{
+		void* block = ::operator new(sizeof(RefCount) + size + 1);
+		data = static_cast<char*>(block) + sizeof(RefCount);
+		new (block) RefCount();
+		storage_ = kShared;
+	}
+	memcpy(data, str, size);
+	data[size] = '\0';
+	value_.text.data = data;
+	value_.text.size = size;
+}
+
+void Json::Unshare()
+{
+	if (kArray == kind_)
+	{
+		if (!value_.array->refs.Unique())
+		{
+			ArrayData* copy = new ArrayData(*value_.array);
+			Release();
+			kind_ = kArray;
+			value_.array = copy;
+		}
+		value_.array->hash.value.store(0, std::memory_order_relaxed);
+	}
+	else if (kObject == kind_)
+	{
+		if (!value_.object->refs.Unique())
+		{
+			ObjectData* copy = new ObjectData(*value_.object);
+			Release();
+			kind_ = kObject;
+			value_.object = copy;
+		}
+		value_.object->hash.value.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Json::Expose()
+{
+	Unshare();
+	if (kArray == kind_) { value_.array->refs.exposed.store(true, std::memory_order_relaxed); }
+	else if (kObject == kind_) { value_.object->refs.exposed.store(true, std::memory_order_relaxed); }
+}
+
+void Json::SetView(const char* str, size_t size)
+{
+	if (size <= kInlineCapacity) { SetString(str, size); return; }
+	kind_ = kString;
+	storage_ = kView;
+	value_.text.data = str;
+	value_.text.size = size;
+}
+
+void Json::SetInterned(const char* str, size_t size)
+{
+	SetView(str, size);
+	if (kView == storage_) { storage_ = kInterned; }
+}
+
+bool Json::IsEmpty() const
+{
+	if (IsObject()) { return value_.object->size() == 0; }
+	if (IsArray()) { return value_.array->size() == 0; }
+	return false;
+}
+
+bool Json::Contains(const char* key) const
+{
+	if (!IsObject()) { return false; }
+	return value_.object->Find(key, strlen(key)) != 0;
+}
+
+bool Json::Contains(const Key& key) const
+{
+	return IsObject() && value_.object->Find(key) != 0;
+}
+
+const Json* Json::Find(const char* key) const
+{
+	if (!IsObject()) { return 0; }
+	const ObjectData::Member* member = value_.object->Find(key, strlen(key));
+	return member ? &member->value : 0;
+}
+
+const Json* Json::Find(const Key& key) const
+{
+	if (!IsObject()) { return 0; }
+	const ObjectData::Member* member = value_.object->Find(key);
+	return member ? &member->value : 0;
+}
+
+vector<std::string> Json::Keys() const
+{
+	vector<string> keys;
+	if (IsObject())
+	{
+		const ObjectData *data = value_.object;
+		ObjectData::const_iterator cit = data->begin();
+		for (; cit != data->end(); ++cit)
+		{
+			keys.push_back(cit->key.AsString());
+		}
+	}
+	return keys;
+}
+
+Json::Range<Json::ItemIterator<Json> > Json::Items()
+{
+	typedef ItemIterator<Json> Iterator;
+	if (!IsObject() || value_.object->empty()) { return Range<Iterator>(Iterator(), Iterator()); }
+	Expose();
+	ObjectData::Member* members = &*value_.object->begin();
+	return Range<Iterator>(Iterator(members), Iterator(members + value_.object->size()));
+}
+
+Json::Range<Json::ItemIterator<const Json> > Json::Items() const
+{
+	typedef ItemIterator<const Json> Iterator;
+	if (!IsObject() || value_.object->empty()) { return Range<Iterator>(Iterator(), Iterator()); }
+	const ObjectData::Member* members = &*value_.object->begin();
+	return Range<Iterator>(Iterator(members), Iterator(members + value_.object->size()));
+}
+
+Json::Range<Json*> Json::Elements()
+{
+	if (!IsArray()) { return Range<Json*>(0, 0); }
+	Expose();
+	return Range<Json*>(value_.array->data(), value_.array->data() + value_.array->size());
+}
+
+Json::Range<const Json*> Json::Elements() const
+{
+	if (!IsArray()) { return Range<const Json*>(0, 0); }
+	return Range<const Json*>(value_.array->data(), value_.array->data() + value_.array->size());
+}
+
+Json& Json::Push(const Json& rhs)
+{
+	TRACK("Json& Json::Push(const Json& rhs)");
+	return Push(Json(rhs));
+}
+
+Json& Json::Push(Json&& rhs)
+{
+	TRACK("Json& Json::Push(Json&& rhs)");
+	switch (kind_)
+	{
+		case kArray:
+		{
+			// rhs may be an element, take it out before the elements move
+			Json item(std::move(rhs));
+			ArrayData& data = Array();
+			Adopt(item);
+			data.push_back(std::move(item));
+			break;
+		}
+		case kNumber: case kString: case kBool: case kNull: case kObject:
+		{
+			// rhs may live inside this Json object, take it out first
+			Json item(std::move(rhs));
+			Json old(std::move(*this));
+			ArrayData *tmp = new ArrayData();
+			tmp->reserve(2);
+			tmp->push_back(std::move(old));
+			tmp->push_back(std::move(item));
+			kind_ = Json::kArray;
+			value_.array = tmp;
+			Adopt((*tmp)[0]);
+			Adopt((*tmp)[1]);
+			break;
+		}
+		default: break;
+	}
+	return *this;
+}
+
+Json& Json::AddProperty(const std::string& key, const Json& value)
+{
+	TRACK("Json& Json::AddProperty(const std::string& key, const Json& value)");
+	return AddProperty(key, Json(value));
+}
+
+Json& Json::AddProperty(const std::string& key, Json&& value)
+{
+	TRACK("Json& Json::AddProperty(const std::string& key, Json&& value)");
+	// no reference is handed out, the object is not exposed
+	Json item(std::move(value));
+	ObjectData& data = Object();
+	Adopt(item);
+	ObjectData::Member* member = data.Find(key.data(), key.size());
+	if (member)
+	{
+		member->value = std::move(item);
+		return *this;
+	}
+	Json name;
+	name.SetString(key.data(), key.size(), data.get_allocator().arena);
+	bool inserted = false;
+	data.Insert(std::move(name), inserted) = std::move(item);
+	return *this;
+}
+
+Json& Json::Remove(const std::string& key)
+{
+	TRACK("Json& Json::Remove(const std::string& key)");
+	ObjectData& data = Object();
+	ObjectData::Member* member = data.Find(key.data(), key.size());
+	if (member) { data.Erase(member); }
+	return *this;
+}
+
+void Json::Remove(int index)
+{
+	TRACK("void Json::Remove(int index)");
+	ArrayData& data = Array();
+	if (index >= 0 && index < Size())
+	{
+		data.erase(data.begin() + index);
+	}
+}
+
+int Json::AsInt() const
+{
+	Expect(kNumber);
+	if (kInt64 == storage_) { return (int)value_.integer; }
+	if (kUInt64 == storage_) { return (int)value_.unsigned_integer; }
+	return (int)value_.number;
+}
+
+int64_t Json::AsInt64() const
+{
+	Expect(kNumber);
+	if (kInt64 == storage_) { return value_.integer; }
+	if (kUInt64 == storage_) { throw BadConversionException(); }
+	// -2^63 and 2^63 are exact doubles
+	if (!(value_.number >= -9223372036854775808.0 && value_.number < 9223372036854775808.0))
+	{
+		throw BadConversionException();
+	}
+	return static_cast<int64_t>(value_.number);
+}
+
+uint64_t Json::AsUInt64() const
+{
+	Expect(kNumber);
+	if (kUInt64 == storage_) { return value_.unsigned_integer; }
+	if (kInt64 == storage_)
+	{
+		if (value_.integer < 0) { throw BadConversionException(); }
+		return static_cast<uint64_t>(value_.integer);
+	}
+	if (!(value_.number > -1.0 && value_.number < 18446744073709551616.0)) { throw BadConversionException(); }
+	return static_cast<uint64_t>(value_.number);
+}
+
+bool Json::AsBool() const
+{
+	Expect(kBool);
+	return value_.boolean;
+}
+
+string Json::AsString() const
+{
+	Expect(kString);
+	return string(StringData(), StringSize());
+}
+
+const Json& Json::operator[] (const char* key) const
+{
+	const ObjectData::Member* member = Object().Find(key, strlen(key));
+	return member ? member->value : Missing();
+}
+
+Json& Json::operator[] (const char* key)
+{
+	Expect(kObject);
+	Expose();
+	ObjectData& data = *value_.object;
+	size_t size = strlen(key);
+	ObjectData::Member* member = data.Find(key, size);
+	if (member) { return member->value; }
+	// allocate the new key the same way as the object
+	Json name;
+	name.SetString(key, size, data.get_allocator().arena);
+	bool inserted = false;
+	return data.Insert(std::move(name), inserted);
+}
+
+const Json& Json::operator[] (const Key& key) const
+{
+	const ObjectData::Member* member = Object().Find(key);
+	return member ? member->value : Missing();
+}
+
+Json& Json::operator[] (const Key& key)
+{
+	Expect(kObject);
+	Expose();
+	ObjectData& data = *value_.object;
+	ObjectData::Member* member = data.Find(key);
+	if (member) { return member->value; }
+	Json name;
+	name.SetInterned(key.Data(), key.Size());
+	bool inserted = false;
+	return data.Insert(std::move(name), inserted);
+}
+
+const Json& Json::Missing()
+{
+	static const Json null;
+	return null;
+}
+
+Json& Json::operator = (int num)
+{
+	return operator = (static_cast<int64_t>(num));
+}
+
+Json& Json::operator = (int64_t num)
+{
+	Release();
+	kind_ = kNumber;
+	storage_ = kInt64;
+	value_.integer = num;
+	return *this;
+}
+
+Json& Json::operator = (uint64_t num)
+{
+	Json integer(num);
+	Swap(integer);
+	return *this;
+}
+
+Json& Json::operator = (double num)
+{
+	Release();
+	kind_ = kNumber;
+	storage_ = kDouble;
+	value_.number = num;
+	return *this;
+}
+
+Json& Json::operator = (const string& str)
+{
+	Release();
+	SetString(str.data(), str.size());
+	return *this;
+}
+
+Json& Json::operator = (const char* str)
+{
+	Release();
+	SetString(str, strlen(str));
+	return *this;
+}
+
+Json& Json::operator = (bool boo)
+{
+	Release();
+	kind_ = kBool;
+	value_.boolean = boo;
+	return *this;
+}
+
+Json Json::MakeArray()
+{
+	Json json;
+	json.kind_ = kArray;
+	json.value_.array = new ArrayData();
+	return json;
+}
+
+Json Json::MakeObject()
+{
+	Json json;
+	json.kind_ = kObject;
+	json.value_.object = new ObjectData();
+	return json;
+}
+
+/**
+ * \brief The finalizer of splitmix64, every bit of \em hash changes about half of the result.
+ */
+static inline uint64_t MixHash(uint64_t hash)
+{
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	return hash ^ (hash >> 31);
+}
+
+/**
+ * \brief 64 bits FNV-1a hash of [data, data + size).
+ */
+static inline uint64_t HashBytes(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i) { hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL; }
+	return hash;
+}
+
+/**
+ * \brief The memoized hash of \em data, or compute and keep it unless it is borrowed or exposed.
+ */
+template <typename Data, typename Compute>
+static uint64_t CachedHash(const Data& data, Compute compute)
+{
+	bool keep = !data.refs.borrowed.load(std::memory_order_relaxed) && !data.refs.exposed.load(std::memory_order_relaxed);
+	uint64_t hash = keep ? data.hash.value.load(std::memory_order_relaxed) : 0;
+	if (hash) { return hash; }
+	hash = compute();
+	if (!hash) { hash = 1; } // 0 means unknown
+	if (keep) { data.hash.value.store(hash, std::memory_order_relaxed); }
+	return hash;
+}
+
+uint64_t Json::Hash() const
+{
+	switch (kind_)
+	{
+		case kNumber:
+		{
+			// integral doubles hash like the integers they equal, see Equal()
+			if (kUInt64 == storage_) { return MixHash(value_.unsigned_integer); }
+			if (kInt64 == storage_) { return MixHash(static_cast<uint64_t>(value_.integer)); }
+			double number = value_.number;
+			if (number >= -9223372036854775808.0 && number < 9223372036854775808.0
+				&& number == static_cast<double>(static_cast<int64_t>(number)))
+			{
+				return MixHash(static_cast<uint64_t>(static_cast<int64_t>(number)));
+			}
+			if (number >= 9223372036854775808.0 && number < 18446744073709551616.0
+				&& number == static_cast<double>(static_cast<uint64_t>(number)))
+			{
+				return MixHash(static_cast<uint64_t>(number));
+			}
+			uint64_t bits = 0;
+			memcpy(&bits, &number, sizeof(bits));
+			return MixHash(bits ^ 0x6e756d626572ULL);
+		}
+		case kString: { return MixHash(HashBytes(StringData(), StringSize()) ^ 0x737472696e67ULL); }
+		case kBool: { return MixHash(value_.boolean ? 0x74727565ULL : 0x66616c7365ULL); }
+		case kNull: { return MixHash(0x6e756c6cULL); }
+		case kArray:
+		{
+			const ArrayData& data = *value_.array;
+			return CachedHash(data, [&data]() {
+				uint64_t hash = MixHash(data.size() ^ 0x6172726179ULL);
+				for (size_t i = 0; i < data.size(); ++i) { hash = MixHash(hash + data[i].Hash()); }
+				return hash;
+			});
+		}
+		case kObject:
+		{
+			// the hashes of the members are added up, their order does not matter
+			const ObjectData& data = *value_.object;
+			return CachedHash(data, [&data]() {
+				uint64_t sum = 0;
+				for (ObjectData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
+				{
+					sum += MixHash(HashBytes(cit->key.StringData(), cit->key.StringSize()) + MixHash(cit->value.Hash()));
+				}
+				return MixHash(sum ^ MixHash(data.size() ^ 0x6f626a656374ULL));
+			});
+		}
+		default: { return 0; }
+	}
+}
+
+/**
+ * \brief Whether the known hashes of \em a and \em b, if both are known, differ.
+ */
+template <typename Data>
+static inline bool KnownHashesDiffer(const Data& a, const Data& b)
+{
+	uint64_t x = a.hash.value.load(std::memory_order_relaxed);
+	uint64_t y = b.hash.value.load(std::memory_order_relaxed);
+	return x && y && x != y;
+}
+
+bool Json::Equal(const Json& a, const Json& b)
+{
+	if (a.kind_ != b.kind_) { return false; }
+	switch (a.kind_)
+	{
+		case kNumber:
+		{
+			if (a.storage_ == b.storage_)
+			{
+				if (kDouble == a.storage_) { return a.value_.number == b.value_.number; }
+				return a.value_.unsigned_integer == b.value_.unsigned_integer; // same bits
+			}
+			if (kDouble != a.storage_ && kDouble != b.storage_) { return false; } // kInt64 below 2^63, kUInt64 above
+			// an integer and a double, equal if the double is that integer exactly
+			const Json& integer = (kDouble == a.storage_) ? b : a;
+			double number = (kDouble == a.storage_) ? a.value_.number : b.value_.number;
+			if (kUInt64 == integer.storage_)
+			{
+				return number >= 9223372036854775808.0 && number < 18446744073709551616.0
+					&& static_cast<uint64_t>(number) == integer.value_.unsigned_integer;
+			}
+			return number >= -9223372036854775808.0 && number < 9223372036854775808.0
+				&& number == static_cast<double>(static_cast<int64_t>(number))
+				&& static_cast<int64_t>(number) == integer.value_.integer;
+		}
+		case kString:
+		{
+			size_t size = a.StringSize();
+			return size == b.StringSize() && (a.StringData() == b.StringData() || 0 == memcmp(a.StringData(), b.StringData(), size));
+		}
+		case kBool: { return a.value_.boolean == b.value_.boolean; }
+		case kNull: { return true; }
+		case kArray:
+		{
+			const ArrayData& x = *a.value_.array;
+			const ArrayData& y = *b.value_.array;
+			if (&x == &y) { return true; }
+			if (x.size() != y.size() || KnownHashesDiffer(x, y)) { return false; }
+			for (size_t i = 0; i < x.size(); ++i)
+			{
+				if (!Equal(x[i], y[i])) { return false; }
+			}
+			return true;
+		}
+		case kObject:
+		{
+			const ObjectData& x = *a.value_.object;
+			const ObjectData& y = *b.value_.object;
+			if (&x == &y) { return true; }
+			if (x.size() != y.size() || KnownHashesDiffer(x, y)) { return false; }
+			for (ObjectData::const_iterator cit = x.begin(); cit != x.end(); ++cit)
+			{
+				const ObjectData::Member* member = y.Find(cit->key.StringData(), cit->key.StringSize());
+				if (!member || !Equal(cit->value, member->value)) { return false; }
+			}
+			return true;
+		}
+		default: { return false; }
+	}
+}
+
+string Json::ToString() const
+{
+	string out;
+	Writer writer(out);
+	writer.Write(*this).Flush();
+	return out;
+}
+
+/* Json::BinaryWriter */
+
+/**
+ * \brief The writer of MessagePack and CBOR, appending to a string.
+ */
+class Json::BinaryWriter
+{
+public:
+	explicit BinaryWriter(string& out) : out_(out) { }
+
+	void MsgPack(const Json& json);
+	void Cbor(const Json& json);
+
+private:
+	void Put(unsigned char byte) { out_ += static_cast<char>(byte); }
+
+	/**
+	 * \brief Put \em byte, then the \em size low bytes of \em value, big endian.
+	 */
+	void Put(unsigned char byte, uint64_t value, int size)
+	{
+		char bytes[9];
+		bytes[0] = static_cast<char>(byte);
+		for (int i = size; i > 0; --i, value >>= 8) { bytes[i] = static_cast<char>(value); }
+		out_.append(bytes, size + 1);
+	}
+
+	/**
+	 * \brief Put \em number after \em single_mark in 4 bytes if a float holds it, else after \em double_mark in 8.
+	 */
+	void PutFloat(double number, unsigned char single_mark, unsigned char double_mark)
+	{
+		if (number >= -FLT_MAX && number <= FLT_MAX && static_cast<float>(number) == number)
+		{
+			float single = static_cast<float>(number);
+			uint32_t bits;
+			memcpy(&bits, &single, sizeof(bits));
+			Put(single_mark, bits, 4);
+			return;
+		}
+		uint64_t bits;
+		memcpy(&bits, &number, sizeof(bits));
+		Put(double_mark, bits, 8);
+	}
+
+	/**
+	 * \brief Put a MessagePack head: \em fix | \em size if it fits in \em fix_limit, else one of \em marks (8, 16, 32 bits).
+	 */
+	void PutMsgPackHead(size_t size, size_t fix_limit, unsigned char fix, const unsigned char marks[3])
+	{
+		if (size < fix_limit) { Put(static_cast<unsigned char>(fix | size)); }
+		else if (size <= 0xff && marks[0]) { Put(marks[0], size, 1); }
+		else if (size <= 0xffff) { Put(marks[1], size, 2); }
+		else if (static_cast<uint64_t>(size) <= 0xffffffffULL) { Put(marks[2], size, 4); }
+		else { throw EncodeException("a length above 0xffffffff"); }
+	}
+
+	/**
+	 * \brief Put a CBOR head: the \em major type and its argument \em value, the shortest way.
+	 */
+	void PutCborHead(unsigned char major, uint64_t value)
+	{
+		major <<= 5;
+		if (value < 24) { Put(static_cast<unsigned char>(major | value)); }
+		else if (value <= 0xff) { Put(major | 24, value, 1); }
+		else if (value <= 0xffff) { Put(major | 25, value, 2); }
+		else if (value <= 0xffffffffULL) { Put(major | 26, value, 4); }
+		else { Put(major | 27, value, 8); }
+	}
+
+	string& out_;
+};
+
+void Json::BinaryWriter::MsgPack(const Json& json)
+{
+	static const unsigned char kStringMarks[3] = { 0xd9, 0xda, 0xdb };
+	static const unsigned char kArrayMarks[3] = { 0, 0xdc, 0xdd };
+	static const unsigned char kMapMarks[3] = { 0, 0xde, 0xdf };
+	switch (json.kind_)
+	{
+		case kNull: { Put(0xc0); break; }
+		case kBool: { Put(json.value_.boolean ? 0xc3 : 0xc2); break; }
+		case kNumber:
+		{
+			if (kDouble == json.storage_) { PutFloat(json.value_.number, 0xca, 0xcb); break; }
+			if (kInt64 == json.storage_ && json.value_.integer < 0)
+			{
+				int64_t integer = json.value_.integer;
+				if (integer >= -32) { Put(static_cast<unsigned char>(integer)); }
+				else if (integer >= INT8_MIN) { Put(0xd0, integer, 1); }
+				else if (integer >= INT16_MIN) { Put(0xd1, integer, 2); }
+				else if (integer >= INT32_MIN) { Put(0xd2, integer, 4); }
+				else { Put(0xd3, integer, 8); }
+				break;
+			}
+			uint64_t integer = json.value_.unsigned_integer;
+			if (integer < 0x80) { Put(static_cast<unsigned char>(integer)); }
+			else if (integer <= 0xff) { Put(0xcc, integer, 1); }
+			else if (integer <= 0xffff) { Put(0xcd, integer, 2); }
+			else if (integer <= 0xffffffffULL) { Put(0xce, integer, 4); }
+			else { Put(0xcf, integer, 8); }
+			break;
+		}
+		case kString:
+		{
+			PutMsgPackHead(json.StringSize(), 32, 0xa0, kStringMarks);
+			out_.append(json.StringData(), json.StringSize());
+			break;
+		}
+		case kArray:
+		{
+			const ArrayData& data = *json.value_.array;
+			PutMsgPackHead(data.size(), 16, 0x90, kArrayMarks);
+			for (size_t i = 0; i < data.size(); ++i) { MsgPack(data[i]); }
+			break;
+		}
+		case kObject:
+		{
+			const ObjectData& data = *json.value_.object;
+			PutMsgPackHead(data.size(), 16, 0x80, kMapMarks);
+			for (ObjectData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
+			{
+				MsgPack(cit->key);
+				MsgPack(cit->value);
+			}
+			break;
+		}
+		default: break;
+	}
+}
+
+void Json::BinaryWriter::Cbor(const Json& json)
+{
+	switch (json.kind_)
+	{
+		case kNull: { Put(0xf6); break; }
+		case kBool: { Put(json.value_.boolean ? 0xf5 : 0xf4); break; }
+		case kNumber:
+		{
+			if (kDouble == json.storage_) { PutFloat(json.value_.number, 0xfa, 0xfb); }
+			else if (kInt64 == json.storage_ && json.value_.integer < 0)
+			{
+				// major type 1 holds -1 - n
+				PutCborHead(1, static_cast<uint64_t>(-(json.value_.integer + 1)));
+			}
+			else { PutCborHead(0, json.value_.unsigned_integer); }
+			break;
+		}
+		case kString:
+		{
+			PutCborHead(3, json.StringSize());
+			out_.append(json.StringData(), json.StringSize());
+			break;
+		}
+		case kArray:
+		{
+			const ArrayData& data = *json.value_.array;
+			PutCborHead(4, data.size());
+			for (size_t i = 0; i < data.size(); ++i) { Cbor(data[i]); }
+			break;
+		}
+		case kObject:
+		{
+			const ObjectData& data = *json.value_.object;
+			PutCborHead(5, data.size());
+			for (ObjectData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
+			{
+				Cbor(cit->key);
+				Cbor(cit->value);
+			}
+			break;
+		}
+		default: break;
+	}
+}
+
+string Json::ToMsgPack() const
+{
+	string out;
+	BinaryWriter(out).MsgPack(*this);
+	return out;
+}
+
+string Json::ToCbor() const
+{
+	string out;
+	BinaryWriter(out).Cbor(*this);
+	return out;
+}
+
+/* Json::BinaryReader */
+
+/**
+ * \brief The reader of MessagePack and CBOR, sending the values to a Builder.
+ *
+ * The open containers are kept on a stack with the number of values left in
+ * them, not on the call stack, so the depth of the data is not limited.
+ */
+class Json::BinaryReader
+{
+public:
+	BinaryReader(const char* data, size_t size, unsigned flags)
+		: data_(reinterpret_cast<const unsigned char*>(data)), pos_(0), size_(size), builder_(data, data + size, flags, 0) { }
+
+	Json ReadMsgPack();
+	Json ReadCbor();
+
+private:
+	static const unsigned kIndefinite = 31;	///< the additional information of a CBOR length closed by a break
+
+	/**
+	 * \brief An array or an object not closed yet.
+	 */
+	struct Open
+	{
+		uint64_t left;		///< number of values (members) to come, unless \em indefinite
+		bool object;
+		bool indefinite;	///< a CBOR container closed by a break, \em left is not used
+	};
+
+	BinaryReader(const BinaryReader&);
+	BinaryReader& operator = (const BinaryReader&);
+
+	/**
+	 * \brief Throw DecodeException for \em reason at \em pos.
+	 */
+	void Fail(const char* reason, size_t pos) { throw DecodeException(reason, pos); }
+
+	/**
+	 * \brief Take the next \em size bytes.
+	 */
+	const char* Need(uint64_t size)
+	{
+		if (size > size_ - pos_) { Fail("data cut", size_); }
+		const char* bytes = reinterpret_cast<const char*>(data_ + pos_);
+		pos_ += static_cast<size_t>(size);
+		return bytes;
+	}
+
+	unsigned char Peek()
+	{
+		if (pos_ == size_) { Fail("data cut", size_); }
+		return data_[pos_];
+	}
+
+	/**
+	 * \brief Take the next \em size bytes as a big endian integer.
+	 */
+	uint64_t Big(size_t size)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(Need(size));
+		uint64_t value = 0;
+		for (size_t i = 0; i < size; ++i) { value = (value << 8) | bytes[i]; }
+		return value;
+	}
+
+	void Integer(uint64_t integer)
+	{
+		if (integer > static_cast<uint64_t>(INT64_MAX)) { builder_.UInt64(integer); }
+		else { builder_.Int64(static_cast<int64_t>(integer)); }
+	}
+
+	/**
+	 * \brief Open a container of \em count values, reserved up to what the bytes left can hold.
+	 */
+	void Start(bool object, uint64_t count, bool indefinite = false)
+	{
+		size_t reserve = static_cast<size_t>(std::min<uint64_t>(indefinite ? 0 : count, size_ - pos_));
+		if (object) { builder_.StartObject(reserve); }
+		else { builder_.StartArray(reserve); }
+		Open open = { count, object, indefinite };
+		open_.push_back(open);
+	}
+
+	void End()
+	{
+		if (open_.back().object) { builder_.EndObject(); }
+		else { builder_.EndArray(); }
+		open_.pop_back();
+	}
+
+	/**
+	 * \brief Close the containers which got all their values.
+	 */
+	void Close()
+	{
+		while (!open_.empty() && !open_.back().indefinite && 0 == open_.back().left) { End(); }
+	}
+
+	/**
+	 * \brief Take the root value, once it is whole and nothing follows it.
+	 */
+	Json Finish()
+	{
+		if (pos_ != size_) { Fail("data after the value", pos_); }
+		Json* json = builder_.Release();
+		Json retval(std::move(*json));
+		delete json;
+		return retval;
+	}
+
+	void MsgPackValue();
+	void MsgPackKey();
+
+	/**
+	 * \brief Read the head of a CBOR data item, after its tags.
+	 * @param  major the major type
+	 * @param  value the argument, 0 for an indefinite length
+	 * @return       the additional information, kIndefinite for an indefinite length
+	 */
+	unsigned CborHead(unsigned& major, uint64_t& value);
+	void CborValue();
+	void CborKey();
+
+	/**
+	 * \brief Join the chunks of an indefinite CBOR string of \em major type into \em chunks_.
+	 */
+	void CborChunks(unsigned major);
+
+	const unsigned char* data_;
+	size_t pos_;				///< the next byte
+	size_t size_;
+	Builder builder_;
+	vector<Open> open_;			///< the open containers
+	string chunks_;				///< an indefinite CBOR string
+};
+
+const unsigned Json::BinaryReader::kIndefinite;
+
+Json Json::BinaryReader::ReadMsgPack()
+{
+	do
+	{
+		if (!open_.empty())
+		{
+			--open_.back().left;
+			if (open_.back().object) { MsgPackKey(); }
+		}
+		MsgPackValue();
+		Close();
+	} while (!open_.empty());
+	return Finish();
+}
+
+void Json::BinaryReader::MsgPackValue()
+{
+	size_t at = pos_;
+	unsigned char byte = static_cast<unsigned char>(*Need(1));
+	if (byte <= 0x7f) { builder_.Int64(byte); return; }
+	if (byte >= 0xe0) { builder_.Int64(static_cast<int8_t>(byte)); return; }
+	if (byte <= 0x8f) { Start(true, byte & 0x0f); return; }
+	if (byte <= 0x9f) { Start(false, byte & 0x0f); return; }
+	if (byte <= 0xbf) { size_t size = byte & 0x1f; builder_.String(Need(size), size); return; }
+	switch (byte)
+	{
+		case 0xc0: { builder_.Null(); break; }
+		case 0xc2: { builder_.Bool(false); break; }
+		case 0xc3: { builder_.Bool(true); break; }
+		case 0xc4: case 0xd9: { size_t size = Big(1); builder_.String(Need(size), size); break; }
+		case 0xc5: case 0xda: { size_t size = Big(2); builder_.String(Need(size), size); break; }
+		case 0xc6: case 0xdb: { size_t size = Big(4); builder_.String(Need(size), size); break; }
+		case 0xca:
+		{
+			uint32_t bits = static_cast<uint32_t>(Big(4));
+			float single;
+			memcpy(&single, &bits, sizeof(single));
+			builder_.Number(single);
+			break;
+		}
+		case 0xcb:
+		{
+			uint64_t bits = Big(8);
+			double number;
+			memcpy(&number, &bits, sizeof(number));
+			builder_.Number(number);
+			break;
+		}
+		case 0xcc: { builder_.Int64(Big(1)); break; }
+		case 0xcd: { builder_.Int64(Big(2)); break; }
+		case 0xce: { builder_.Int64(Big(4)); break; }
+		case 0xcf: { Integer(Big(8)); break; }
+		case 0xd0: { builder_.Int64(static_cast<int8_t>(Big(1))); break; }
+		case 0xd1: { builder_.Int64(static_cast<int16_t>(Big(2))); break; }
+		case 0xd2: { builder_.Int64(static_cast<int32_t>(Big(4))); break; }
+		case 0xd3: { builder_.Int64(static_cast<int64_t>(Big(8))); break; }
+		case 0xdc: { Start(false, Big(2)); break; }
+		case 0xdd: { Start(false, Big(4)); break; }
+		case 0xde: { Start(true, Big(2)); break; }
+		case 0xdf: { Start(true, Big(4)); break; }
+		default: { Fail("an unsupported type", at); }
+	}
+}
+
+void Json::BinaryReader::MsgPackKey()
+{
+	size_t at = pos_;
+	unsigned char byte = static_cast<unsigned char>(*Need(1));
+	size_t size = 0;
+	if (byte >= 0xa0 && byte <= 0xbf) { size = byte & 0x1f; }
+	else if (0xd9 == byte || 0xc4 == byte) { size = Big(1); }
+	else if (0xda == byte || 0xc5 == byte) { size = Big(2); }
+	else if (0xdb == byte || 0xc6 == byte) { size = Big(4); }
+	else { Fail("a key which is not a string", at); }
+	builder_.Key(Need(size), size);
+}
+
+Json Json::BinaryReader::ReadCbor()
+{
+	do
+	{
+		if (!open_.empty())
+		{
+			if (!open_.back().indefinite) { --open_.back().left; }
+			else if (0xff == Peek())
+			{
+				++pos_;
+				End();
+				Close();
+				continue;
+			}
+			if (open_.back().object) { CborKey(); }
+		}
+		CborValue();
+		Close();
+	} while (!open_.empty());
+	return Finish();
+}
+
+unsigned Json::BinaryReader::CborHead(unsigned& major, uint64_t& value)
+{
+	for (;;)
+	{
+		size_t at = pos_;
+		unsigned char byte = static_cast<unsigned char>(*Need(1));
+		major = byte >> 5;
+		unsigned info = byte & 0x1f;
+		if (info < 24) { value = info; }
+		else if (info < 28) { value = Big(static_cast<size_t>(1) << (info - 24)); }
+		else if (kIndefinite == info && major >= 2 && major <= 5) { value = 0; }
+		else { Fail("a wrong head", at); }
+		if (6 != major) { return info; } // the tags are skipped
+	}
+}
+
+void Json::BinaryReader::CborValue()
+{
+	size_t at = pos_;
+	unsigned major;
+	uint64_t value;
+	unsigned info = CborHead(major, value);
+	bool indefinite = (kIndefinite == info);
+	switch (major)
+	{
+		case 0: { Integer(value); break; }
+		case 1:
+		{
+			if (value <= static_cast<uint64_t>(INT64_MAX)) { builder_.Int64(-1 - static_cast<int64_t>(value)); }
+			else { builder_.Number(-1.0 - static_cast<double>(value)); }
+			break;
+		}
+		case 2: case 3:
+		{
+			if (indefinite) { CborChunks(major); builder_.String(chunks_.data(), chunks_.size()); }
+			else { builder_.String(Need(value), static_cast<size_t>(value)); }
+			break;
+		}
+		case 4: { Start(false, value, indefinite); break; }
+		case 5: { Start(true, value, indefinite); break; }
+		default:
+		{
+			if (20 == info || 21 == info) { builder_.Bool(21 == info); }
+			else if (22 == info || 23 == info) { builder_.Null(); }
+			else if (25 == info)
+			{
+				// half precision
+				int exponent = static_cast<int>(value >> 10) & 0x1f;
+				double mantissa = static_cast<double>(value & 0x3ff);
+				double number = (0 == exponent) ? ldexp(mantissa, -24)
+					: (31 != exponent) ? ldexp(mantissa + 1024, exponent - 25)
+					: (0 == mantissa) ? HUGE_VAL : NAN;
+				builder_.Number((value & 0x8000) ? -number : number);
+			}
+			else if (26 == info)
+			{
+				uint32_t bits = static_cast<uint32_t>(value);
+				float single;
+				memcpy(&single, &bits, sizeof(single));
+				builder_.Number(single);
+			}
+			else if (27 == info)
+			{
+				double number;
+				memcpy(&number, &value, sizeof(number));
+				builder_.Number(number);
+			}
+			else { Fail("an unsupported simple value", at); }
+		}
+	}
+}
+
+void Json::BinaryReader::CborKey()
+{
+	size_t at = pos_;
+	unsigned major;
+	uint64_t value;
+	unsigned info = CborHead(major, value);
+	if (2 != major && 3 != major) { Fail("a key which is not a string", at); }
+	if (kIndefinite == info) { CborChunks(major); builder_.Key(chunks_.data(), chunks_.size()); }
+	else { builder_.Key(Need(value), static_cast<size_t>(value)); }
+}
+
+void Json::BinaryReader::CborChunks(unsigned major)
+{
+	chunks_.clear();
+	while (0xff != Peek())
+	{
+		size_t at = pos_;
+		unsigned chunk_major;
+		uint64_t size;
+		unsigned info = CborHead(chunk_major, size);
+		if (chunk_major != major || kIndefinite == info) { Fail("a wrong chunk", at); }
+		chunks_.append(Need(size), static_cast<size_t>(size));
+	}
+	++pos_;
+}
+
+Json Json::FromMsgPack(const char* data, size_t size, ParseFlag flags/* = kParseDefault */)
+{
+	return BinaryReader(data, size, flags).ReadMsgPack();
+}
+
+Json Json::FromCbor(const char* data, size_t size, ParseFlag flags/* = kParseDefault */)
+{
+	return BinaryReader(data, size, flags).ReadCbor();
+}
+
+/* Json::ObjectData */
+
+const Json::ObjectData::Member* Json::ObjectData::Find(const char* key, size_t size) const
+{
+	return Find(key, size, index_.empty() ? 0 : HashKey(key, size));
+}
+
+const Json::ObjectData::Member* Json::ObjectData::Find(const Key& key) const
+{
+	return Find(key.Data(), key.Size(), key.Hash());
+}
+
+inline bool Json::ObjectData::SameKey(const Member& member, const char* key, size_t size)
+{
+	const Json& name = member.key;
+	return name.StringSize() == size && (name.StringData() == key || 0 == memcmp(name.StringData(), key, size));
+}
+
+const Json::ObjectData::Member* Json::ObjectData::Find(const char* key, size_t size, uint32_t hash) const
+{
+	if (index_.empty())
+	{
+		for (const_iterator cit = members_.begin(); cit != members_.end(); ++cit)
+		{
+			if (SameKey(*cit, key, size)) { return &*cit; }
+		}
+		return 0;
+	}
+	size_t mask = index_.size() - 1;
+	for (size_t slot = hash & mask; index_[slot]; slot = (slot + 1) & mask)
+	{
+		const Member& member = members_[index_[slot] - 1];
+		if (SameKey(member, key, size)) { return &member; }
+	}
+	return 0;
+}
+
+Json& Json::ObjectData::Insert(Json&& key, bool& inserted)
+{
+	Member* found = Find(key.StringData(), key.StringSize());
+	inserted = !found;
+	if (found) { return found->value; }
+	Member member = { std::move(key), Json() };
+	members_.push_back(std::move(member));
+	// keep the index at most half full
+	if (members_.size() * 2 > index_.size() && members_.size() > kIndexThreshold)
+	{
+		Reindex(index_.empty() ? 4 * kIndexThreshold : 2 * index_.size());
+	}
+	else if (!index_.empty()) { Place(members_.size() - 1); }
+	return members_.back().value;
+}
+
+void Json::ObjectData::Erase(Member* member)
+{
+	members_.erase(members_.begin() + (member - members_.data()));
+	// the positions after the member have changed
+	if (!index_.empty()) { Reindex(index_.size()); }
+}
+
+void Json::ObjectData::InsertAt(size_t position, Member&& member)
+{
+	members_.insert(members_.begin() + position, std::move(member));
+	if (members_.size() * 2 > index_.size() && members_.size() > kIndexThreshold)
+	{
+		Reindex(index_.empty() ? 4 * kIndexThreshold : 2 * index_.size());
+	}
+	else if (!index_.empty()) { Reindex(index_.size()); } // the positions after it have changed
+}
+
+void Json::ObjectData::Reindex(size_t slots)
+{
+	if (members_.size() <= kIndexThreshold) { index_.clear(); return; }
+	index_.assign(slots, 0);
+	for (size_t i = 0; i < members_.size(); ++i) { Place(i); }
+}
+
+void Json::ObjectData::Place(size_t position)
+{
+	const Json& key = members_[position].key;
+	size_t mask = index_.size() - 1;
+	size_t slot = HashKey(key.StringData(), key.StringSize()) & mask;
+	while (index_[slot]) { slot = (slot + 1) & mask; }
+	index_[slot] = static_cast<uint32_t>(position + 1);
+}
+
+/* Json::Key */
+
+/**
+ * \brief The process-wide set of interned keys, it only grows.
+ */
+class KeyTable
+{
+public:
+	KeyTable() : slots_(64), count_(0) { }
+
+	/**
+	 * \brief The interned copy of [str, str + size), allocated the first time.
+	 */
+	const char* Intern(const char* str, size_t size, uint32_t hash)
+	{
+		lock_guard<mutex> lock(mutex_);
+		if (2 * (count_ + 1) > slots_.size()) { Grow(); }
+		size_t mask = slots_.size() - 1;
+		for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+		{
+			Entry& entry = slots_[slot];
+			if (!entry.data)
+			{
+				char* data = new char[size + 1];
+				memcpy(data, str, size);
+				data[size] = '\0';
+				entry.data = data;
+				entry.size = size;
+				entry.hash = hash;
+				++count_;
+				return data;
+			}
+			if (entry.hash == hash && entry.size == size && 0 == memcmp(entry.data, str, size)) { return entry.data; }
+		}
+	}
+
+private:
+	struct Entry
+	{
+		Entry() : data(0), size(0), hash(0) { }
+		const char* data;
+		size_t size;
+		uint32_t hash;
+	};
+
+	void Grow()
+	{
+		vector<Entry> old(2 * slots_.size());
+		old.swap(slots_);
+		size_t mask = slots_.size() - 1;
+		for (size_t i = 0; i < old.size(); ++i)
+		{
+			if (!old[i].data) { continue; }
+			size_t slot = old[i].hash & mask;
+			while (slots_[slot].data) { slot = (slot + 1) & mask; }
+			slots_[slot] = old[i];
+		}
+	}
+
+	mutex mutex_;
+	vector<Entry> slots_;	///< open addressing, a power of 2 of them, at most half full
+	size_t count_;			///< number of keys
+};
+
+const char* Json::Intern(const char* str, size_t size, uint32_t hash)
+{
+	// a direct-mapped cache per thread, keys seen before do not take the lock
+	struct Cached { const char* data; size_t size; };
+	static thread_local Cached cache[256];
+	Cached& cached = cache[hash & 255];
+	if (cached.data && cached.size == size && 0 == memcmp(cached.data, str, size)) { return cached.data; }
+	static KeyTable* table = new KeyTable(); // never deleted, the keys live as long as the process
+	cached.data = table->Intern(str, size, hash);
+	cached.size = size;
+	return cached.data;
+}
+
+Json::Key::Key(const char* str) : data_(0), size_(strlen(str)), hash_(HashKey(str, size_))
+{
+	data_ = Intern(str, size_, hash_);
+}
+
+Json::Key::Key(const std::string& str) : data_(0), size_(str.size()), hash_(HashKey(str.data(), size_))
+{
+	data_ = Intern(str.data(), size_, hash_);
+}
+
+Json::Key::Key(const char* str, size_t size) : data_(0), size_(size), hash_(HashKey(str, size))
+{
+	data_ = Intern(str, size_, hash_);
+}
+
+/* Json::Pointer */
+
+/**
+ * \brief Split the JSON Pointer \em pointer into its unescaped reference tokens.
+ * @return the position of the first wrong character, or -1 if \em pointer is well formed
+ */
+static int SplitPointer(const string& pointer, vector<string>& tokens)
+{
+	tokens.clear();
+	const char* begin = pointer.data();
+	const char* end = begin + pointer.size();
+	const char* p = begin;
+	if (p != end && '/' != *p) { return 0; }
+	while (p != end)
+	{
+		tokens.push_back(string());
+		string& token = tokens.back();
+		for (++p; p != end && '/' != *p; ++p)
+		{
+			if ('~' != *p) { token += *p; continue; }
+			// only "~0" and "~1" are escapes
+			if (++p == end || ('0' != *p && '1' != *p)) { return static_cast<int>(p - begin); }
+			token += ('0' == *p) ? '~' : '/';
+		}
+	}
+	return -1;
+}
+
+/**
+ * \brief The reference token \em token as an array index, or ~0 if it is not one.
+ * \note An index is "0" or digits without a leading zero, "-" is not one.
+ */
+static size_t ArrayIndex(const string& token)
+{
+	const size_t kNoIndex = ~static_cast<size_t>(0);
+	if (token.empty() || ('0' == token[0] && token.size() > 1)) { return kNoIndex; }
+	size_t index = 0;
+	for (size_t i = 0; i < token.size(); ++i)
+	{
+		size_t digit = token[i] - '0';
+		if (!IsDigit(token[i]) || index > (kNoIndex - 1 - digit) / 10) { return kNoIndex; }
+		index = index * 10 + digit;
+	}
+	return index;
+}
+
+Json::Pointer::Pointer(const char* pointer) : text_(pointer)
+{
+	Compile();
+}
+
+Json::Pointer::Pointer(const std::string& pointer) : text_(pointer)
+{
+	Compile();
+}
+
+void Json::Pointer::Compile()
+{
+	vector<string> tokens;
+	int error = SplitPointer(text_, tokens);
+	if (error >= 0)
+	{
+		throw UnexpectedTokenException(error < static_cast<int>(text_.size()) ? text_[error] : '\0', error);
+	}
+	for (size_t i = 0; i < tokens.size(); ++i) { segments_.push_back(Segment(Key(tokens[i]), ArrayIndex(tokens[i]))); }
+}
+
+inline const Json* Json::Pointer::Step(const Json& json, const Segment& segment)
+{
+	if (kObject == json.kind_)
+	{
+		const ObjectData::Member* member = json.value_.object->Find(segment.key);
+		return member ? &member->value : 0;
+	}
+	if (kArray == json.kind_ && segment.index < json.value_.array->size()) { return &(*json.value_.array)[segment.index]; }
+	return 0;
+}
+
+const Json* Json::Find(const Pointer& pointer) const
+{
+	const Json* json = this;
+	const Pointer::Segment* segment = pointer.segments_.data();
+	const Pointer::Segment* end = segment + pointer.segments_.size();
+	for (; json && segment != end; ++segment) { json = Pointer::Step(*json, *segment); }
+	return json;
+}
+
+/* Json::Pointers */
+Json::Pointers::Pointers() : count_(0)
+{
+	nodes_.push_back(Node(Pointer::Segment(Key("", 0), Pointer::kNoIndex)));
+}
+
+size_t Json::Pointers::Add(const Pointer& pointer)
+{
+	uint32_t node = 0;
+	for (size_t i = 0; i < pointer.segments_.size(); ++i)
+	{
+		const Pointer::Segment& segment = pointer.segments_[i];
+		// interned keys are equal when their characters are
+		uint32_t child = nodes_[node].child;
+		uint32_t last = 0;
+		while (child && nodes_[child].segment.key.Data() != segment.key.Data())
+		{
+			last = child;
+			child = nodes_[child].sibling;
+		}
+		if (!child)
+		{
+			child = static_cast<uint32_t>(nodes_.size());
+			nodes_.push_back(Node(segment));
+			if (last) { nodes_[last].sibling = child; }
+			else { nodes_[node].child = child; }
+		}
+		node = child;
+	}
+	if (!nodes_[node].result) { nodes_[node].result = static_cast<uint32_t>(++count_); }
+	return nodes_[node].result - 1;
+}
+
+void Json::Pointers::Visit(uint32_t node, const Json& json, const Json** results) const
+{
+	for (uint32_t child = nodes_[node].child; child; child = nodes_[child].sibling)
+	{
+		const Node& next = nodes_[child];
+		const Json* value = Pointer::Step(json, next.segment);
+		if (!value) { continue; }
+		if (next.result) { results[next.result - 1] = value; }
+		if (next.child) { Visit(child, *value, results); }
+	}
+}
+
+void Json::Find(const Pointers& pointers, std::vector<const Json*>& results) const
+{
+	results.assign(pointers.Size(), 0);
+	if (results.empty()) { return; }
+	if (pointers.nodes_[0].result) { results[pointers.nodes_[0].result - 1] = this; }
+	pointers.Visit(0, *this, results.data());
+}
+
+/* Json::Differ */
+
+/**
+ * \brief Append the JSON Pointer reference token of [str, str + size) to \em pointer.
+ */
+static void AppendToken(string& pointer, const char* str, size_t size)
+{
+	pointer += '/';
+	for (size_t i = 0; i < size; ++i)
+	{
+		if ('~' == str[i]) { pointer += "~0"; }
+		else if ('/' == str[i]) { pointer += "~1"; }
+		else { pointer += str[i]; }
+	}
+}
+
+static void AppendToken(string& pointer, size_t index)
+{
+	char digits[24];
+	int size = snprintf(digits, sizeof(digits), "%zu", index);
+	AppendToken(pointer, digits, size);
+}
+
+class Json::Differ
+{
+public:
+	explicit Differ(Json& patch) : patch_(patch) { }
+
+	/**
+	 * \brief Append the operations turning \em from into \em to, at \em path_.
+	 */
+	void Diff(const Json& from, const Json& to)
+	{
+		if (Equal(from, to)) { return; }
+		if (from.kind_ != to.kind_ || (kObject != from.kind_ && kArray != from.kind_)) { Emit("replace", &to); }
+		else if (kObject == from.kind_) { DiffObjects(*from.value_.object, *to.value_.object); }
+		else { DiffArrays(*from.value_.array, *to.value_.array); }
+	}
+
+private:
+	static const size_t kNone = ~static_cast<size_t>(0);
+
+	void DiffObjects(const ObjectData& from, const ObjectData& to)
+	{
+		size_t size = path_.size();
+		for (ObjectData::const_iterator cit = from.begin(); cit != from.end(); ++cit)
+		{
+			const ObjectData::Member* member = to.Find(cit->key.StringData(), cit->key.StringSize());
+			AppendToken(path_, cit->key.StringData(), cit->key.StringSize());
+			if (!member) { Emit("remove", 0); }
+			else { Diff(cit->value, member->value); }
+			path_.resize(size);
+		}
+		for (ObjectData::const_iterator cit = to.begin(); cit != to.end(); ++cit)
+		{
+			if (from.Find(cit->key.StringData(), cit->key.StringSize())) { continue; }
+			AppendToken(path_, cit->key.StringData(), cit->key.StringSize());
+			Emit("add", &cit->value);
+			path_.resize(size);
+		}
+	}
+
+	/**
+	 * \brief Patch the elements between the common head and tail of \em from and \em to.
+	 *
+	 * The elements of \em to are matched with equal elements of \em from by their
+	 * hashes, the ones left are paired in order and patched in place, the others
+	 * are removed or added. The matched elements out of order are moved.
+	 */
+	void DiffArrays(const ArrayData& from, const ArrayData& to)
+	{
+		size_t head = 0;
+		while (head < from.size() && head < to.size() && Equal(from[head], to[head])) { ++head; }
+		size_t tail = 0;
+		while (tail < from.size() - head && tail < to.size() - head
+			&& Equal(from[from.size() - 1 - tail], to[to.size() - 1 - tail])) { ++tail; }
+		size_t old_count = from.size() - head - tail;
+		size_t new_count = to.size() - head - tail;
+
+		vector<size_t> source(new_count, kNone);	// the element of from for each one of to
+		vector<bool> changed(new_count, false);		// source is not equal, to be patched
+		vector<bool> used(old_count, false);
+		if (old_count && new_count)
+		{
+			unordered_map<uint64_t, vector<size_t> > by_hash;
+			for (size_t i = 0; i < old_count; ++i) { by_hash[from[head + i].Hash()].push_back(i); }
+			for (size_t j = 0; j < new_count; ++j)
+			{
+				unordered_map<uint64_t, vector<size_t> >::const_iterator found = by_hash.find(to[head + j].Hash());
+				if (found == by_hash.end()) { continue; }
+				for (size_t k = 0; k < found->second.size(); ++k)
+				{
+					size_t i = found->second[k];
+					if (!used[i] && Equal(from[head + i], to[head + j])) { used[i] = true; source[j] = i; break; }
+				}
+			}
+			for (size_t j = 0, i = 0; j < new_count; ++j)
+			{
+				if (kNone != source[j]) { continue; }
+				while (i < old_count && used[i]) { ++i; }
+				if (i == old_count) { break; }
+				used[i] = true;
+				source[j] = i;
+				changed[j] = true;
+			}
+		}
+
+		size_t size = path_.size();
+		// remove the elements with no place in to, from the last one
+		for (size_t i = old_count; i-- > 0; )
+		{
+			if (used[i]) { continue; }
+			AppendToken(path_, head + i);
+			Emit("remove", 0);
+			path_.resize(size);
+		}
+		// then put the elements of to in place one after another
+		vector<size_t> current;
+		for (size_t i = 0; i < old_count; ++i)
+		{
+			if (used[i]) { current.push_back(i); }
+		}
+		for (size_t j = 0; j < new_count; ++j)
+		{
+			AppendToken(path_, head + j);
+			if (kNone == source[j])
+			{
+				Emit("add", &to[head + j]);
+				current.insert(current.begin() + j, kNone);
+			}
+			else
+			{
+				size_t at = std::find(current.begin() + j, current.end(), source[j]) - current.begin();
+				if (at != j)
+				{
+					string from_path = path_.substr(0, size);
+					AppendToken(from_path, head + at);
+					Emit("move", 0, &from_path);
+					current.erase(current.begin() + at);
+					current.insert(current.begin() + j, source[j]);
+				}
+				if (changed[j]) { Diff(from[head + source[j]], to[head + j]); }
+			}
+			path_.resize(size);
+		}
+	}
+
+	/**
+	 * \brief Append the operation \em op at \em path_, with \em value or \em from if given.
+	 */
+	void Emit(const char* op, const Json* value, const string* from = 0)
+	{
+		Json operation = MakeObject();
+		operation.AddProperty("op", Json(op));
+		if (from) { operation.AddProperty("from", Json(*from)); }
+		operation.AddProperty("path", Json(path_));
+		if (value) { operation.AddProperty("value", *value); }
+		patch_.Push(std::move(operation));
+	}
+
+	Json& patch_;		///< the array of operations
+	string path_;		///< pointer to the values compared
+};
+
+const size_t Json::Differ::kNone;
+
+Json Json::Diff(const Json& from, const Json& to)
+{
+	// hash both once, the hashes of the containers are kept for the comparisons
+	from.Hash();
+	to.Hash();
+	Json patch = MakeArray();
+	Differ differ(patch);
+	differ.Diff(from, to);
+	return patch;
 }
 
-Json::Json() : kind_(kNull), data_(0) { }
-Json::Json(int num) : kind_(kNumber), data_(new double(num)) { }
-Json::Json(double num) : kind_(kNumber), data_(new double(num)) { }
-Json::Json(const string& str) : kind_(kString), data_(new string(str)) { }
-Json::Json(const char* str) : kind_(kString), data_(new string(str)) { }
-Json::Json(bool boo) : kind_(kBool), data_(new bool(boo)) { }
-Json::Json(const Json& rhs) : kind_(kNull), data_(0)
+/* Json::Patcher */
+class Json::Patcher
 {
-	TRACK("Json::Json(const Json& rhs)");
-	DoDeepCopy(rhs);
+public:
+	explicit Patcher(Json& root) : root_(root) { }
+
+	/**
+	 * \brief Apply the operation \em operation, throw PatchException if it fails.
+	 */
+	void Apply(const Json& operation)
+	{
+		const Json* op = operation.Find("op");
+		if (!op || !op->IsString()) { throw PatchException("an operation without op", ""); }
+		string name = op->AsString();
+		Split(operation, "path", path_, pointer_);
+		if ("add" == name) { Put(path_, Json(Value(operation)), true); }
+		else if ("remove" == name) { Take(path_); }
+		else if ("replace" == name) { Put(path_, Json(Value(operation)), false); }
+		else if ("test" == name)
+		{
+			if (!Equal(Get(path_), Value(operation))) { throw PatchException("test failed", pointer_); }
+		}
+		else if ("move" == name || "copy" == name)
+		{
+			string to = pointer_;
+			Split(operation, "from", from_, pointer_);
+			// a value can not be moved into itself
+			bool inside = from_.size() < path_.size() && std::equal(from_.begin(), from_.end(), path_.begin());
+			if ("move" == name && inside) { throw PatchException("move into itself", pointer_); }
+			// the moved value is copied (cheaply), the undo log keeps the original
+			Json value(Get(from_));
+			if ("move" == name) { Take(from_); }
+			pointer_ = to;
+			Put(path_, std::move(value), true);
+		}
+		else { throw PatchException("an unknown op", pointer_); }
+	}
+
+	/**
+	 * \brief Undo the operations applied so far, the last one first.
+	 */
+	void Rollback()
+	{
+		while (!changes_.empty())
+		{
+			Revert(changes_.back());
+			changes_.pop_back();
+		}
+	}
+
+private:
+	/**
+	 * \brief A change made by an operation, with what is needed to undo it.
+	 */
+	struct Change
+	{
+		enum Undo
+		{
+			kPutBack,	///< put value back in place of the one there
+			kDrop,		///< remove the value added
+			kReinsert	///< insert key and value back at position
+		};
+
+		Change(Undo undo, const vector<string>& tokens, size_t position = 0)
+			: undo(undo), tokens(tokens), position(position) { }
+
+		Undo undo;
+		vector<string> tokens;	///< the path of the value changed
+		size_t position;		///< its index in the array, or in the members of the object
+		Json key;				///< the key of a removed member
+		Json value;				///< the value replaced or removed
+	};
+
+	void Revert(Change& change)
+	{
+		if (change.tokens.empty()) { root_ = std::move(change.value); return; }
+		Json& parent = Walk(change.tokens, change.tokens.size() - 1);
+		parent.Unshare();
+		const string& token = change.tokens.back();
+		if (parent.IsObject())
+		{
+			ObjectData& data = *parent.value_.object;
+			if (Change::kPutBack == change.undo) { data.Find(token.data(), token.size())->value = std::move(change.value); }
+			else if (Change::kDrop == change.undo) { data.Erase(data.Find(token.data(), token.size())); }
+			else
+			{
+				ObjectData::Member member = { std::move(change.key), std::move(change.value) };
+				data.InsertAt(change.position, std::move(member));
+			}
+			return;
+		}
+		ArrayData& data = *parent.value_.array;
+		if (Change::kPutBack == change.undo) { data[change.position] = std::move(change.value); }
+		else if (Change::kDrop == change.undo) { data.erase(data.begin() + change.position); }
+		else { data.insert(data.begin() + change.position, std::move(change.value)); }
+	}
+
+	/**
+	 * \brief Split the pointer of member \em name of \em operation into \em tokens.
+	 */
+	void Split(const Json& operation, const char* name, vector<string>& tokens, string& pointer)
+	{
+		const Json* member = operation.Find(name);
+		if (!member || !member->IsString()) { throw PatchException("an operation without a pointer", name); }
+		pointer = member->AsString();
+		if (SplitPointer(pointer, tokens) >= 0) { throw PatchException("a wrong pointer", pointer); }
+	}
+
+	const Json& Value(const Json& operation)
+	{
+		const Json* value = operation.Find("value");
+		if (!value) { throw PatchException("an operation without value", pointer_); }
+		return *value;
+	}
+
+	/**
+	 * \brief The value at \em count first \em tokens, its containers unshared to be modified.
+	 */
+	Json& Walk(const vector<string>& tokens, size_t count)
+	{
+		Json* json = &root_;
+		for (size_t i = 0; i < count; ++i)
+		{
+			json->Unshare();
+			json = Child(*json, tokens[i]);
+			if (!json) { throw PatchException("no value", pointer_); }
+		}
+		return *json;
+	}
+
+	static Json* Child(Json& json, const string& token)
+	{
+		if (json.IsObject())
+		{
+			ObjectData::Member* member = json.value_.object->Find(token.data(), token.size());
+			return member ? &member->value : 0;
+		}
+		size_t index = ArrayIndex(token);
+		if (json.IsArray() && index < json.value_.array->size()) { return &(*json.value_.array)[index]; }
+		return 0;
+	}
+
+	const Json& Get(const vector<string>& tokens)
+	{
+		const Json* json = &root_;
+		for (size_t i = 0; json && i < tokens.size(); ++i) { json = Child(const_cast<Json&>(*json), tokens[i]); }
+		if (!json) { throw PatchException("no value", pointer_); }
+		return *json;
+	}
+
+	/**
+	 * \brief Make room for one more change, so that logging a change made can not fail.
+	 */
+	void Reserve()
+	{
+		if (changes_.size() == changes_.capacity()) { changes_.reserve(2 * changes_.size() + 4); }
+	}
+
+	/**
+	 * \brief Add \em value at \em tokens, or replace the value there (which must exist).
+	 */
+	void Put(const vector<string>& tokens, Json&& value, bool add)
+	{
+		Reserve();
+		if (tokens.empty())
+		{
+			Change change(Change::kPutBack, tokens);
+			change.value = std::move(root_);
+			root_ = std::move(value);
+			changes_.push_back(std::move(change));
+			return;
+		}
+		Json& parent = Walk(tokens, tokens.size() - 1);
+		const string& token = tokens.back();
+		if (parent.IsObject())
+		{
+			parent.Unshare();
+			parent.Adopt(value);
+			ObjectData& data = *parent.value_.object;
+			ObjectData::Member* member = data.Find(token.data(), token.size());
+			if (!member && !add) { throw PatchException("no value", pointer_); }
+			Change change(member ? Change::kPutBack : Change::kDrop, tokens);
+			if (member)
+			{
+				change.value = std::move(member->value);
+				member->value = std::move(value);
+			}
+			else
+			{
+				Json name;
+				name.SetString(token.data(), token.size());
+				bool inserted = false;
+				data.Insert(std::move(name), inserted) = std::move(value);
+			}
+			changes_.push_back(std::move(change));
+			return;
+		}
+		if (!parent.IsArray()) { throw PatchException("no container", pointer_); }
+		parent.Unshare();
+		parent.Adopt(value);
+		ArrayData& data = *parent.value_.array;
+		size_t index = ("-" == token && add) ? data.size() : ArrayIndex(token);
+		if (add ? index > data.size() : index >= data.size()) { throw PatchException("no value", pointer_); }
+		Change change(add ? Change::kDrop : Change::kPutBack, tokens, index);
+		if (add) { data.insert(data.begin() + index, std::move(value)); }
+		else
+		{
+			change.value = std::move(data[index]);
+			data[index] = std::move(value);
+		}
+		changes_.push_back(std::move(change));
+	}
+
+	/**
+	 * \brief Remove the value at \em tokens, the undo log keeps it.
+	 */
+	void Take(const vector<string>& tokens)
+	{
+		Reserve();
+		if (tokens.empty())
+		{
+			Change change(Change::kPutBack, tokens);
+			change.value = std::move(root_);
+			changes_.push_back(std::move(change));
+			return;
+		}
+		Json& parent = Walk(tokens, tokens.size() - 1);
+		if (!Child(parent, tokens.back())) { throw PatchException("no value", pointer_); }
+		parent.Unshare();
+		const string& token = tokens.back();
+		if (parent.IsObject())
+		{
+			ObjectData& data = *parent.value_.object;
+			ObjectData::Member* member = data.Find(token.data(), token.size());
+			Change change(Change::kReinsert, tokens, member - &*data.begin());
+			change.key = std::move(member->key);
+			change.value = std::move(member->value);
+			data.Erase(member);
+			changes_.push_back(std::move(change));
+			return;
+		}
+		ArrayData& data = *parent.value_.array;
+		size_t index = ArrayIndex(token);
+		Change change(Change::kReinsert, tokens, index);
+		change.value = std::move(data[index]);
+		data.erase(data.begin() + index);
+		changes_.push_back(std::move(change));
+	}
+
+	Json& root_;
+	vector<string> path_;	///< tokens of "path"
+	vector<string> from_;	///< tokens of "from"
+	string pointer_;		///< the pointer in error messages
+	vector<Change> changes_;	///< the undo log
+};
+
+Json& Json::ApplyPatch(const Json& patch)
+{
+	if (!patch.IsArray()) { throw PatchException("a patch which is not an array", ""); }
+	// a copy of the patch (cheap, shared) stays valid even if it lives inside this Json object
+	const Json operations(patch);
+	Patcher patcher(*this);
+	try
+	{
+		for (const Json& operation : operations.Elements()) { patcher.Apply(operation); }
+	}
+	catch (...)
+	{
+		patcher.Rollback();
+		throw;
+	}
+	return *this;
 }
 
-Json& Json::operator = (const Json& rhs)
+Json& Json::MergePatch(Json&& patch)
 {
-	TRACK("Json& Json::operator = (const Json& rhs)");
-	if (this == &rhs) { return *this; }
-	Release();
-	DoDeepCopy(rhs);
+	// take the patch first, it may live inside this Json object
+	Json source(std::move(patch));
+	if (kObject != source.kind_)
+	{
+		*this = std::move(source);
+		return *this;
+	}
+	ObjectData& changes = *source.value_.object;
+	// the members are stolen from a patch nobody else holds, the others are copied (cheaply),
+	// so are the ones of a patch which is not Settled(), they may be views of the input
+	bool owned = changes.refs.Unique() && Settled(source);
+	if (kObject != kind_)
+	{
+		// take the object of the patch itself, only its nulls are left to remove
+		if (owned) { Swap(source); DropNulls(); return *this; }
+		*this = MakeObject();
+	}
+	ObjectData& data = Object();
+	for (ObjectData::iterator it = changes.begin(); it != changes.end(); ++it)
+	{
+		ObjectData::Member* member = data.Find(it->key.StringData(), it->key.StringSize());
+		if (kNull == it->value.kind_)
+		{
+			if (member) { data.Erase(member); }
+			continue;
+		}
+		bool inserted = false;
+		Json& value = member ? member->value : data.Insert(owned ? std::move(it->key) : Json(it->key), inserted);
+		Json change(owned ? std::move(it->value) : Json(it->value));
+		if (kObject != change.kind_) { Adopt(change); } // an object is merged member by member
+		value.MergePatch(std::move(change));
+	}
 	return *this;
 }
 
-Json::Json(Json* rhs) : kind_(rhs->kind_), data_(rhs->data_)
+/**
+ * \brief Whether an object of \em json has a null member.
+ */
+static bool HasNulls(const Json& json)
+{
+	if (!json.IsObject()) { return false; }
+	for (const Json::ConstItem& item : json.Items())
+	{
+		if (item.value.IsNull() || HasNulls(item.value)) { return true; }
+	}
+	return false;
+}
+
+void Json::DropNulls()
 {
-	TRACK("Json::Json(Json* rhs)");
-	rhs->data_ = 0;
+	// the objects without nulls stay shared
+	if (!HasNulls(*this)) { return; }
+	ObjectData& data = Object();
+	for (size_t i = data.size(); i-- > 0; )
+	{
+		ObjectData::Member* member = &*(data.begin() + i);
+		if (kNull == member->value.kind_) { data.Erase(member); }
+		else { member->value.DropNulls(); }
+	}
 }
 
-Json::Json(ObjectData* obj) : kind_(kObject), data_(obj) { }
-Json::Json(ArrayData* arr) : kind_(kArray), data_(arr) { }
+/* Json::Arena */
+Json::Arena::Arena() : blocks_(0), cursor_(0), limit_(0), next_size_(kMinBlockSize) { }
 
-void Json::DoDeepCopy(const Json& rhs)
+Json::Arena::~Arena()
 {
-	TRACK("void Json::DoDeepCopy(const Json& rhs)");
-	kind_ = rhs.kind_;
-	switch (kind_)
+	FreeBlocks(blocks_);
+}
+
+void* Json::Arena::Allocate(size_t size, size_t alignment)
+{
+	size_t misalign = reinterpret_cast<size_t>(cursor_) & (alignment - 1);
+	size_t padding = misalign ? alignment - misalign : 0;
+	if (!blocks_ || size + padding > static_cast<size_t>(limit_ - cursor_))
 	{
-		case kNull: data_ = 0; break;
-		case kNumber: data_ = new double(*static_cast<const double*>(rhs.data_)); break;
-		case kString: data_ = new string(*static_cast<const string*>(rhs.data_)); break;
-		case kBool: data_ = new bool(*static_cast<const bool*>(rhs.data_)); break;
-		case kArray:
+		NewBlock(size + alignment);
+		misalign = reinterpret_cast<size_t>(cursor_) & (alignment - 1);
+		padding = misalign ? alignment - misalign : 0;
+	}
+	void* p = cursor_ + padding;
+	cursor_ += padding + size;
+	return p;
+}
+
+void Json::Arena::Reset()
+{
+	if (!blocks_) { return; }
+	// the newest block is the largest one (or an oversized one), keep it
+	FreeBlocks(blocks_->next);
+	blocks_->next = 0;
+	cursor_ = reinterpret_cast<char*>(blocks_ + 1);
+	limit_ = cursor_ + blocks_->size;
+}
+
+void Json::Arena::NewBlock(size_t min_size)
+{
+	size_t size = next_size_ < min_size ? min_size : next_size_;
+	if (next_size_ < kMaxBlockSize) { next_size_ *= 2; }
+	Block* block = static_cast<Block*>(malloc(sizeof(Block) + size));
+	if (!block) { throw bad_alloc(); }
+	block->next = blocks_;
+	block->size = size;
+	blocks_ = block;
+	cursor_ = reinterpret_cast<char*>(block + 1);
+	limit_ = cursor_ + size;
+}
+
+void Json::Arena::FreeBlocks(Block* block)
+{
+	while (block)
+	{
+		Block* next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+/* Json::Document */
+Json::Document::Document() : root_(0) { }
+
+Json::Document::~Document() { }
+
+const Json& Json::Document::Parse(const char* json_string, ParseFlag flags)
+{
+	return Parse(json_string, strlen(json_string), flags);
+}
+
+const Json& Json::Document::Parse(const char* data, size_t size, ParseFlag flags)
+{
+	Clear();
+	Parser parser(data, size, flags);
+	Builder builder(parser, &arena_);
+	parser.ParseDocument(builder);
+	root_ = builder.Release();
+	return *root_;
+}
+
+void Json::Document::Clear()
+{
+	root_ = 0;
+	arena_.Reset();
+}
+
+/* Json::Writer */
+Json::Writer::Writer(string& out)
+	: sink_(kToString), string_(&out), origin_(out.size()), file_(0), fd_(-1), capacity_(0), written_(0)
+{
+	begin_ = cursor_ = limit_ = &out[0] + origin_;
+}
+
+Json::Writer::Writer(FILE* file)
+	: sink_(kToFile), string_(0), origin_(0), file_(file), fd_(-1), capacity_(0), written_(0)
+{
+	begin_ = cursor_ = staging_;
+	limit_ = staging_ + kStagingSize;
+}
+
+Json::Writer::Writer(int fd)
+	: sink_(kToDescriptor), string_(0), origin_(0), file_(0), fd_(fd), capacity_(0), written_(0)
+{
+	begin_ = cursor_ = staging_;
+	limit_ = staging_ + kStagingSize;
+}
+
+Json::Writer::Writer(char* buffer, size_t capacity)
+	: sink_(kToBuffer), string_(0), origin_(0), file_(0), fd_(-1), capacity_(capacity), written_(0)
+{
+	begin_ = cursor_ = buffer;
+	limit_ = buffer + capacity;
+}
+
+Json::Writer::~Writer()
+{
+	try { Flush(); }
+	catch (exception& e) { }
+}
+
+Json::Writer& Json::Writer::Write(const Json& json)
+{
+	PutValue(json);
+	return *this;
+}
+
+void Json::Writer::Flush()
+{
+	switch (sink_)
+	{
+		case kToString:
 		{
-			ArrayData *tmp = new ArrayData();
-			const ArrayData& data = *CAST_JSON_ARR(rhs.data_);
-			ArrayData::const_iterator cit = data.begin();
-			for (; cit != data.end(); ++cit)
+			// cut the room left at the end
+			size_t size = cursor_ - &(*string_)[0];
+			string_->resize(size);
+			written_ += cursor_ - begin_;
+			begin_ = cursor_ = limit_ = &(*string_)[0] + size;
+			break;
+		}
+		case kToFile:
+		case kToDescriptor:
+		{
+			Drain(0);
+			if (kToFile == sink_ && 0 != fflush(file_)) { throw FileException("FILE* sink", errno); }
+			break;
+		}
+		default: break; // the caller buffer is written in place
+	}
+}
+
+void Json::Writer::Drain(size_t room)
+{
+	switch (sink_)
+	{
+		case kToString:
+		{
+			size_t size = cursor_ - &(*string_)[0];
+			string_->resize(std::max(2 * string_->size(), size + std::max(room, static_cast<size_t>(256))));
+			char* data = &(*string_)[0];
+			begin_ = data + origin_ + written_;
+			cursor_ = data + size;
+			limit_ = data + string_->size();
+			return;
+		}
+		case kToFile:
+		{
+			size_t size = cursor_ - begin_;
+			if (fwrite(begin_, 1, size, file_) != size) { throw FileException("FILE* sink", errno); }
+			break;
+		}
+		case kToDescriptor:
+		{
+			for (const char* p = begin_; p != cursor_; )
 			{
-				tmp->push_back(new Json(*(*cit)));
+#ifdef _WIN32
+				int n = _write(fd_, p, static_cast<unsigned>(cursor_ - p));
+#else
+				ssize_t n = write(fd_, p, cursor_ - p);
+#endif
+				if (n < 0 && EINTR == errno) { continue; }
+				if (n < 0) { throw FileException("file descriptor sink", errno); }
+				p += n;
 			}
-			data_ = tmp;
 			break;
 		}
-		case kObject:
+		default: break; // kToBuffer: what does not fit is only counted
+	}
+	written_ += cursor_ - begin_;
+	begin_ = cursor_ = staging_;
+	limit_ = staging_ + kStagingSize;
+}
+
+void Json::Writer::Put(const char* str, size_t size)
+{
+	while (size > static_cast<size_t>(limit_ - cursor_))
+	{
+		size_t n = limit_ - cursor_;
+		memcpy(cursor_, str, n);
+		cursor_ += n;
+		str += n;
+		size -= n;
+		Drain(size);
+	}
+	memcpy(cursor_, str, size);
+	cursor_ += size;
+}
+
+void Json::Writer::PutQuoted(const char* str, size_t size)
+{
+	static const char* kHex = "0123456789abcdef";
+	Scanner find_special = g_find_string_special.load(memory_order_relaxed);
+	const char* end = str + size;
+	Put('\"');
+	for (const char* p = str; ; ++p)
+	{
+		// the plain characters are copied in runs
+		const char* special = find_special(p, end);
+		Put(p, special - p);
+		if (special == end) { break; }
+		p = special;
+		switch (*p)
 		{
-			ObjectData *tmp = new ObjectData();
-			const ObjectData& data = *CAST_JSON_OBJ(rhs.data_);
-			ObjectData::const_iterator cit = data.begin();
-			for (; cit != data.end(); ++cit)
+			case '\"': Put("\\\"", 2); break;
+			case '\\': Put("\\\\", 2); break;
+			case '\b': Put("\\b", 2); break;
+			case '\f': Put("\\f", 2); break;
+			case '\n': Put("\\n", 2); break;
+			case '\r': Put("\\r", 2); break;
+			case '\t': Put("\\t", 2); break;
+			case 0x7F: Put(*p); break;
+			default:
 			{
-				tmp->insert(make_pair(cit->first, new Json(*cit->second)));
+				char escape[6] = {'\\', 'u', '0', '0', kHex[*p >> 4], kHex[*p & 0xF]};
+				Put(escape, sizeof(escape));
+				break;
 			}
-			data_ = tmp;
-			break;
 		}
-		default: break;
 	}
+	Put('\"');
 }
 
-void Json::Release()
+void Json::Writer::PutNumber(double number)
 {
-	TRACK("void Json::Release()");
-	TRACK("----------------------------------- Delete[" << kind_ << "]: " << ToString());
-	switch (kind_)
+	char text[32];
+	Put(text, FormatDouble(number, text) - text);
+}
+
+void Json::Writer::PutInteger(uint64_t magnitude, bool negative)
+{
+	char text[24];
+	char* out = text;
+	if (negative) { *out++ = '-'; }
+	Put(text, FormatInteger(magnitude, out) - text);
+}
+
+void Json::Writer::PutValue(const Json& json)
+{
+	switch (json.kind_)
 	{
-		case kNumber: delete static_cast<double*>(data_); break;
-		case kString: delete static_cast<string*>(data_); break;
-		case kBool: delete static_cast<bool*>(data_); break;
+		case kNumber:
+		{
+			if (kDouble == json.storage_) { PutNumber(json.value_.number); }
+			else if (kUInt64 == json.storage_) { PutInteger(json.value_.unsigned_integer, false); }
+			else if (json.value_.integer < 0) { PutInteger(0 - static_cast<uint64_t>(json.value_.integer), true); }
+			else { PutInteger(static_cast<uint64_t>(json.value_.integer), false); }
+			break;
+		}
+		case kString: PutQuoted(json.StringData(), json.StringSize()); break;
+		case kBool: json.value_.boolean ? Put("true", 4) : Put("false", 5); break;
+		case kNull: Put("null", 4); break;
 		case kObject:
 		{
-			Json::DestroyObjectData(*CAST_JSON_OBJ(data_));
-			delete CAST_JSON_OBJ(data_);
+			const ObjectData& data = *json.value_.object;
+			Put("{ ", 2);
+			for (ObjectData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
+			{
+				if (cit != data.begin()) { Put(", ", 2); }
+				PutQuoted(cit->key.StringData(), cit->key.StringSize());
+				Put(": ", 2);
+				PutValue(cit->value);
+			}
+			Put(" }", 2);
 			break;
 		}
 		case kArray:
 		{
-			Json::DestroyArrayData(*CAST_JSON_ARR(data_));
-			delete CAST_JSON_ARR(data_);
+			const ArrayData& data = *json.value_.array;
+			Put("[ ", 2);
+			for (ArrayData::const_iterator cit = data.begin(); cit != data.end(); ++cit)
+			{
+				if (cit != data.begin()) { Put(", ", 2); }
+				PutValue(*cit);
+			}
+			Put(" ]", 2);
 			break;
 		}
 		default: break;
 	}
-	data_ = 0;
-	kind_ = kNull;
 }
 
-Json::~Json()
+/* Json::PushParser */
+Json::PushParser::PushParser() : builder_(new Builder(0)) { Reset(); }
+
+Json::PushParser::~PushParser() { delete builder_; }
+
+void Json::PushParser::Reset()
 {
-	TRACK("~Json");
-	if (!data_) { return; }
-	Release();
+	delete builder_;
+	builder_ = new Builder(0);
+	closers_.clear();
+	values_.clear();
+	token_.clear();
+	state_ = kValue;
+	key_ = false;
+	escaped_ = false;
+	offset_ = 0;
+	token_offset_ = 0;
+	chunk_ = 0;
 }
 
-bool Json::IsEmpty() const
+void Json::PushParser::Feed(const char* data, size_t size)
 {
-	if (IsObject()) { return CAST_JSON_OBJ(data_)->size() == 0; }
-	if (IsArray()) { return CAST_JSON_ARR(data_)->size() == 0; }
-	return false;
-}
+	TRACK("void Json::PushParser::Feed(const char* data, size_t size)");
+	const char* p = data;
+	const char* end = data + size;
+	const char* mark = data;	// where the current token starts in this chunk
+	chunk_ = data;
+	while (p != end)
+	{
+		switch (state_)
+		{
+			case kString:
+			{
+				p = g_find_string_special.load(memory_order_relaxed)(p, end);
+				if (p == end) { break; }
+				if ('\"' == *p) { EndString(mark, ++p); }
+				else if ('\\' == *p) { escaped_ = true; state_ = kEscape; ++p; }
+				else { Unexpected(*p, Position(p)); } // a control character
+				break;
+			}
+			case kEscape:
+			{
+				// checked with the whole string when it ends
+				state_ = kString;
+				++p;
+				break;
+			}
+			case kNumber:
+			{
+				while (p != end && (IsDigit(*p) || '.' == *p || 'e' == *p || 'E' == *p || '+' == *p || '-' == *p)) { ++p; }
+				if (p == end) { break; }
+				if (!IsSpace(*p) && !IsOperator(*p)) { Unexpected(*p, Position(p)); }
+				token_.append(mark, p);
+				EndNumber(*p, Position(p));
+				break;
+			}
+			case kLiteral:
+			{
+				while (p != end && *p >= 'a' && *p <= 'z') { ++p; }
+				if (p == end) { break; }
+				token_.append(mark, p);
+				EndLiteral(*p, Position(p));
+				break;
+			}
+			default:
+			{
+				p = g_skip_spaces.load(memory_order_relaxed)(p, end);
+				if (p == end) { break; }
+				mark = p;
+				Structural(p++);
+				break;
+			}
+		}
+	}
+	// keep the beginning of a token for the next chunk
+	if (state_ >= kString) { token_.append(mark, end); }
+	offset_ += size;
+	chunk_ = 0;
+} // end fn:Feed
 
-bool Json::Contains(const char* key) const
+void Json::PushParser::Finish()
 {
-	if (!IsObject()) { return false; }
-	const ObjectData &data = *CAST_JSON_OBJ(data_);
-	return data.find(key) != data.end();
+	if (kNumber == state_) { EndNumber('\0', offset_); }
+	else if (kLiteral == state_) { EndLiteral('\0', offset_); }
+	if (kValue != state_ || !closers_.empty()) { Unexpected('\0', offset_); }
 }
 
-int Json::Size() const
+bool Json::PushParser::Next(Json& json)
 {
-	if (!IsArray()) { return 1; } 
-	return CAST_JSON_ARR(data_)->size();
+	if (values_.empty()) { return false; }
+	json = std::move(values_.front());
+	values_.pop_front();
+	return true;
 }
 
-vector<std::string> Json::Keys() const
+void Json::PushParser::Structural(const char* p)
 {
-	vector<string> keys;
-	if (IsObject())
+	char ch = *p;
+	switch (state_)
 	{
-		ObjectData *data = CAST_JSON_OBJ(data_);
-		ObjectData::const_iterator cit = data->begin();
-		for (; cit != data->end(); ++cit)
+		case kFirstValue:
+		case kValue:
 		{
-			keys.push_back(cit->first);
+			if ('{' == ch) { builder_->StartObject(); closers_.push_back('}'); state_ = kFirstKey; }
+			else if ('[' == ch) { builder_->StartArray(); closers_.push_back(']'); state_ = kFirstValue; }
+			else if ('\"' == ch) { key_ = false; BeginToken(kString, p); }
+			else if ('-' == ch || IsDigit(ch)) { BeginToken(kNumber, p); }
+			else if ('t' == ch || 'f' == ch || 'n' == ch) { BeginToken(kLiteral, p); }
+			else if (']' == ch && kFirstValue == state_) { builder_->EndArray(); closers_.pop_back(); EndValue(); }
+			else { Unexpected(ch, Position(p)); }
+			break;
 		}
-	}
-	return keys;
-}
-
-Json& Json::Push(const Json& rhs)
-{
-	TRACK("Json& Json::Push(const Json& rhs)");
-	switch (kind_)
-	{
-		case kArray:
+		case kFirstKey:
+		case kKey:
 		{
-			ArrayData *data = CAST_JSON_ARR(data_);
-			data->push_back(new Json(rhs));
+			if ('\"' == ch) { key_ = true; BeginToken(kString, p); }
+			else if ('}' == ch && kFirstKey == state_) { builder_->EndObject(); closers_.pop_back(); EndValue(); }
+			else { Unexpected(ch, Position(p)); }
 			break;
 		}
-		case kNumber: case kString: case kBool: case kNull: case kObject:
+		case kColon:
 		{
-			Json* old = new Json(this);
-			kind_ = Json::kArray;
-			ArrayData *tmp = new ArrayData();
-			tmp->push_back(old);
-			tmp->push_back(new Json(rhs));
-			data_ = tmp;
+			if (':' != ch) { Unexpected(ch, Position(p)); }
+			state_ = kValue;
+			break;
+		}
+		default: // kComma
+		{
+			if (',' == ch) { state_ = ('}' == closers_.back()) ? kKey : kValue; }
+			else if (ch == closers_.back())
+			{
+				if ('}' == ch) { builder_->EndObject(); }
+				else { builder_->EndArray(); }
+				closers_.pop_back();
+				EndValue();
+			}
+			else { Unexpected(ch, Position(p)); }
 			break;
 		}
-		default: break;
 	}
-	return *this;
-}
+} // end fn:Structural
 
-Json& Json::AddProperty(const std::string& key, const Json& value)
+void Json::PushParser::BeginToken(State state, const char* p)
 {
-	TRACK("Json& Json::AddProperty(const std::string& key, const Json& value)");
-	(*this)[key.c_str()] = value;
-	return *this;
+	state_ = state;
+	escaped_ = false;
+	token_.clear();
+	token_offset_ = Position(p);
 }
 
-Json& Json::Remove(const std::string& key)
+void Json::PushParser::EndString(const char* begin, const char* end)
 {
-	TRACK("Json& Json::Remove(const std::string& key)");
-	ObjectData& data = Data<ObjectData>();
-	ObjectData::iterator it = data.find(key);
-	if (it != data.end())
+	const char* text = begin + 1;
+	size_t size = end - begin - 2;
+	Parser parser("");
+	if (escaped_ || !token_.empty())
 	{
-		delete it->second;
-		data.erase(it);
+		token_.append(begin, end);
+		text = token_.data() + 1;
+		size = token_.size() - 2;
 	}
-	return *this;
-}
+	if (escaped_)
+	{
+		// unescape (and check) the escape sequences like Parse() does
+		parser.source = token_.c_str();
+		parser.end = parser.source + token_.size();
+		try { parser.ScanString(); }
+		catch (UnexpectedTokenException& e) { Unexpected(parser.character, token_offset_ + parser.pos); }
+		text = parser.text;
+		size = parser.text_size;
+	}
+	if (key_)
+	{
+		builder_->Key(text, size);
+		state_ = kColon;
+	}
+	else
+	{
+		builder_->String(text, size);
+		EndValue();
+	}
+} // end fn:EndString
 
-void Json::Remove(int index)
+void Json::PushParser::EndNumber(char next, size_t next_position)
 {
-	TRACK("void Json::Remove(int index)");
-	ArrayData& data = Data<ArrayData>();
-	if (index >= 0 && index < Size())
+	Parser parser(token_.c_str());
+	Parser::Number number;
+	try
 	{
-		ArrayData::iterator it = data.begin() + index;
-		delete (*it);
-		data.erase(it);
+		parser.ScanNumber(number);
+		// the whole token is a number, e.g. not "1-2"
+		if (parser.pos + 1 != static_cast<ptrdiff_t>(token_.size())) { parser.UnexpectedAt(parser.source + parser.pos + 1); }
 	}
-}
+	catch (UnexpectedTokenException& e)
+	{
+		// past the token, e.g. "1." is cut by what follows it
+		if (parser.pos >= static_cast<ptrdiff_t>(token_.size())) { Unexpected(next, next_position); }
+		Unexpected(parser.character, token_offset_ + parser.pos);
+	}
+	Parser::EmitNumber(*builder_, number);
+	EndValue();
+} // end fn:EndNumber
 
-int Json::AsInt() const
+void Json::PushParser::EndLiteral(char next, size_t next_position)
 {
-	return (int)Data<double>();
-}
+	const char* word = ('t' == token_[0]) ? "true" : ('f' == token_[0]) ? "false" : "null";
+	size_t i = 0;
+	while (i < token_.size() && '\0' != word[i] && token_[i] == word[i]) { ++i; }
+	if (i < token_.size()) { Unexpected(token_[i], token_offset_ + i); }
+	if ('\0' != word[i]) { Unexpected(next, next_position); }
+	if ('\0' != next && !IsSpace(next) && !IsOperator(next)) { Unexpected(next, next_position); }
+	if ('n' == word[0]) { builder_->Null(); }
+	else { builder_->Bool('t' == word[0]); }
+	EndValue();
+} // end fn:EndLiteral
 
-double Json::AsDouble() const
+void Json::PushParser::EndValue()
 {
-	return Data<double>();
+	if (!closers_.empty())
+	{
+		state_ = kComma;
+		return;
+	}
+	Json* json = builder_->Release();
+	values_.push_back(std::move(*json));
+	delete json;
+	state_ = kValue;
 }
 
-bool Json::AsBool() const
+void Json::PushParser::Unexpected(char ch, size_t position)
 {
-	return Data<bool>();
+	throw UnexpectedTokenException(ch, static_cast<ptrdiff_t>(position));
 }
 
-string Json::AsString() const
+/**
+ * \brief The thread pool of ParseLines().
+ *
+ * The input is cut into chunks of whole lines, dealt to the workers in turn.
+ * A worker parses its own chunks first to last, then steals the first chunk
+ * of another worker. The calling thread takes the chunks in order and hands
+ * their values to the callback, the workers wait when they are kWindow chunks
+ * per worker ahead of it.
+ */
+class Json::LinePool
 {
-	return Data<string>().c_str();
-}
+public:
+	LinePool(const char* data, size_t size, unsigned threads, unsigned flags);
 
-const Json& Json::operator [] (int index) const
-{
-	return *Data<ArrayData>()[index];
-}
+	/**
+	 * \brief Stop the workers and wait for them.
+	 */
+	~LinePool();
 
-Json& Json::operator [] (int index)
-{
-	return *Data<ArrayData>()[index];
-}
+	/**
+	 * \brief Start the workers, hand the values to \em callback in order.
+	 */
+	void Run(const LineCallback& callback);
 
-const Json& Json::operator[] (const char* key) const
-{
-	ObjectData& data = const_cast<ObjectData&>(Data<ObjectData>());
-	if (data.find(key) == data.end()) { data[key] = new Json(); }
-	return *(data[key]);
-}
+private:
+	struct Chunk
+	{
+		Chunk(const char* b, const char* e) : begin(b), end(e), lines(0), done(false) { }
 
-Json& Json::operator[] (const char* key)
-{
-	return const_cast<Json&>(static_cast<const Json&>(*this)[key]);
-}
+		const char* begin;							///< the first line
+		const char* end;							///< after the '\n' of the last line, or the end
+		std::vector<std::pair<size_t, Json> > values;	///< the values and their lines in the chunk
+		size_t lines;								///< number of lines
+		std::exception_ptr error;					///< the syntax error stopping the chunk
+		bool done;									///< parsed, guarded by \em mutex_
+	};
 
-Json& Json::operator = (int num)
-{
-	return operator = ((double)num);
-}
+	struct Worker
+	{
+		std::mutex mutex;			///< guards \em chunks, others steal from them
+		std::deque<size_t> chunks;	///< indexes of the chunks left, in order
+	};
 
-Json& Json::operator = (double num)
+	static const size_t kWindow = 4;		///< chunks parsed ahead of the callback per worker
+	static const size_t kMinChunkSize = 1 << 16;
+
+	LinePool(const LinePool&);
+	LinePool& operator = (const LinePool&);
+
+	/**
+	 * \brief Take the next chunk of worker \em self, or steal one.
+	 * @return false if there is no chunk left at all
+	 */
+	bool Take(unsigned self, size_t& index);
+
+	/**
+	 * \brief The loop of worker \em self.
+	 */
+	void Work(unsigned self);
+
+	/**
+	 * \brief Parse the lines of \em chunk where they are, \em parser is reused.
+	 */
+	void Parse(Chunk& chunk, Parser& parser);
+
+	std::vector<Chunk> chunks_;
+	std::vector<Worker> workers_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;					///< guards \em delivered_, \em stop_ and Chunk::done
+	std::condition_variable ready_;		///< a chunk is parsed
+	std::condition_variable window_;	///< a chunk is delivered, or stop
+	size_t delivered_;					///< number of chunks handed to the callback
+	bool stop_;
+	unsigned flags_;
+};
+
+Json::LinePool::LinePool(const char* data, size_t size, unsigned threads, unsigned flags)
+	: delivered_(0), stop_(false), flags_(flags & ~kParseStringViews)
 {
-	Release();
-	kind_ = kNumber;
-	data_ = new double(num);
-	return *this;
+	if (0 == threads) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+	// many more chunks than workers, so they can balance the work
+	size_t target = std::max(size / (threads * 16) + 1, static_cast<size_t>(kMinChunkSize));
+	const char* end = data + size;
+	for (const char* p = data; p != end; )
+	{
+		const char* cut = end;
+		if (static_cast<size_t>(end - p) > target)
+		{
+			cut = static_cast<const char*>(memchr(p + target, '\n', end - p - target));
+			cut = cut ? cut + 1 : end;
+		}
+		chunks_.push_back(Chunk(p, cut));
+		p = cut;
+	}
+	threads = static_cast<unsigned>(std::min<size_t>(threads, chunks_.size()));
+	std::vector<Worker>(threads).swap(workers_);
+	for (size_t i = 0; i < chunks_.size(); ++i) { workers_[i % threads].chunks.push_back(i); }
 }
 
-Json& Json::operator = (const string& str)
+Json::LinePool::~LinePool()
 {
-	return operator = (str.c_str());
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	window_.notify_all();
+	for (size_t i = 0; i < threads_.size(); ++i) { threads_[i].join(); }
 }
 
-Json& Json::operator = (const char* str)
+void Json::LinePool::Run(const LineCallback& callback)
 {
-	Release();
-	kind_ = kString;
-	data_ = new string(str);
-	return *this;
+	for (unsigned i = 0; i < workers_.size(); ++i) { threads_.push_back(std::thread(&LinePool::Work, this, i)); }
+	size_t base = 0;	// number of lines in the chunks delivered
+	for (size_t c = 0; c < chunks_.size(); ++c)
+	{
+		Chunk& chunk = chunks_[c];
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (!chunk.done) { ready_.wait(lock); }
+		}
+		for (size_t i = 0; i < chunk.values.size(); ++i)
+		{
+			callback(base + chunk.values[i].first, chunk.values[i].second);
+		}
+		if (chunk.error)
+		{
+			// the parser only knows the position in the line, the chunk stopped at the line
+			try { std::rethrow_exception(chunk.error); }
+			catch (const UnexpectedTokenException& error) { throw UnexpectedTokenException(error, base + chunk.lines); }
+		}
+		base += chunk.lines;
+		std::vector<std::pair<size_t, Json> >().swap(chunk.values);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			delivered_ = c + 1;
+		}
+		window_.notify_all();
+	}
 }
 
-Json& Json::operator = (bool boo)
+bool Json::LinePool::Take(unsigned self, size_t& index)
 {
-	Release();
-	kind_ = kBool;
-	data_ = new bool(boo);
-	return *this;
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		Worker& worker = workers_[(self + i) % workers_.size()];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.chunks.empty())
+		{
+			index = worker.chunks.front();
+			worker.chunks.pop_front();
+			return true;
+		}
+	}
+	return false;
 }
 
-string Json::ToString() const
+void Json::LinePool::Work(unsigned self)
 {
-	ostringstream oss;
-	switch (kind_)
+	Parser parser("", flags_);
+	size_t index;
+	while (Take(self, index))
 	{
-		case kNumber: oss << *static_cast<double*>(data_); break;
-		case kString: oss << "\"" << *static_cast<string*>(data_) << "\""; break;
-		case kBool: oss << boolalpha << *static_cast<bool*>(data_); break;
-		case kNull: oss << "null"; break;
-		case kObject:
 		{
-			ObjectData& data = *CAST_JSON_OBJ(data_);
-			ObjectData::const_iterator cit = data.begin();
-			oss << "{ ";
-			bool unique = true;
-			for (; cit != data.end(); ++cit)
-			{
-				oss << (unique ? "\"" : ", \"") << cit->first << "\": " << cit->second->ToString();
-				unique = false;
-			}
-			oss << " }";
-			break;
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (!stop_ && index >= delivered_ + kWindow * workers_.size()) { window_.wait(lock); }
+			if (stop_) { return; }
 		}
-		case kArray:
+		Parse(chunks_[index], parser);
 		{
-			ArrayData& data = *CAST_JSON_ARR(data_);
-			ArrayData::const_iterator cit = data.begin();
-			oss << "[ ";
-			bool unique = true;
-			for (; cit != data.end(); ++cit)
-			{
-				oss << (unique ? "" : ", ") << (*cit)->ToString();
-				unique = false;
-			}
-			oss << " ]";
-			break;
+			std::lock_guard<std::mutex> lock(mutex_);
+			chunks_[index].done = true;
 		}
-		default : break;
+		ready_.notify_all();
 	}
-	return oss.str();
 }
 
-/* Private Members */
-void Json::DestroyArrayData(ArrayData& arr)
+void Json::LinePool::Parse(Chunk& chunk, Parser& parser)
 {
-	TRACK("void Json::DestroyArrayData(ArrayData& arr)");
-	for (ArrayData::iterator it = arr.begin(); it != arr.end(); ++it)
+	Scanner skip_spaces = g_skip_spaces.load(memory_order_relaxed);
+	const char* p = chunk.begin;
+	for (; p != chunk.end; ++chunk.lines)
 	{
-		delete *it;
-		*it = 0;
+		const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+		if (!eol) { eol = chunk.end; }
+		if (skip_spaces(p, eol) != eol) // not a blank line
+		{
+			parser.Reset(p, eol - p);
+			Builder builder(parser, 0);
+			try { parser.ParseDocument(builder); }
+			catch (...)
+			{
+				chunk.error = std::current_exception();
+				return;
+			}
+			Json* json = builder.Release();
+			chunk.values.push_back(std::make_pair(chunk.lines, std::move(*json)));
+			delete json;
+		}
+		p = (eol == chunk.end) ? eol : eol + 1;
 	}
 }
 
-void Json::DestroyObjectData(ObjectData& obj)
+void Json::ParseLines(const char* data, size_t size, const LineCallback& callback, unsigned threads, ParseFlag flags)
 {
-	TRACK("void Json::DestroyObjectData(ObjectData& obj)");
-	for (ObjectData::iterator it = obj.begin(); it != obj.end(); ++it)
-	{
-		delete it->second;
-		it->second = 0;
-	}
+	LinePool pool(data, size, threads, flags);
+	pool.Run(callback);
 }
 
 /* Json::Parser */
-Json::Parser::Parser(const char* json_string)
+Json::Parser::Parser(const char* json_string, unsigned flags)
+{
+	this->flags = flags;
+	Reset(json_string, strlen(json_string));
+}
+
+Json::Parser::Parser(const char* data, size_t size, unsigned flags)
+{
+	this->flags = flags;
+	Reset(data, size);
+}
+
+void Json::Parser::Reset(const char* json_string, size_t size)
 {
 	source = json_string;
+	end = json_string + size;
 	pos = -1;
 	character = ' ';
-	token = "";
+	token.clear();
+	text = 0;
+	text_size = 0;
 }
 
-Json* Json::Parser::ConsumeValue(bool section/* = true */)
+void Json::Parser::BuildStructuralIndex()
 {
-	TRACK("Json Json::Parser::ConsumeValue()");
-	SkipWhitespaces();
-	Kind kind = KindDetect();
-	Json* (Json::Parser::*consumer)(); // member function pointer
-	switch (kind)
-	{
-		case kNumber: { consumer = &Json::Parser::ConsumeNumber; break; }
-		case kString: { consumer = &Json::Parser::ConsumeString; break; }
-		case kBool: { consumer = &Json::Parser::ConsumeBool; break; }
-		case kNull: { consumer = &Json::Parser::ConsumeNull; break; }
-		case kObject: { consumer = &Json::Parser::ConsumeObject; break; }
-		case kArray: { consumer = &Json::Parser::ConsumeArray; break; }
-		default: { throw; break; }
-	}
-	Json *json = (this->*consumer)();
-	if (!section && !EOL())
-	{
-		SkipWhitespaces();
-		NextCharacter();
-		if (!EOL()) { UnexpectedToken(); }
-	}
-	if (section) { SkipWhitespaces(); }
-	return json;
-} // end fn:ConsumeValue
+	TRACK("void Json::Parser::BuildStructuralIndex()");
+	Classifier classify = g_classify.load(memory_order_relaxed);
+	size_t length = end - source;
+	size_t count = 0;
+	structurals.resize(length / 8 + 64);
+	bool escape_carry = false;		// the previous block ends with an escaping backslash
+	uint64_t string_carry = 0;		// all ones if the previous block ends inside a string
+	uint64_t scalar_carry = 0;		// 1 if the previous block ends inside a scalar token
+	char padded[64];
+	for (size_t offset = 0; offset < length; offset += 64)
+	{
+		const char* block = source + offset;
+		if (length - offset < 64)
+		{
+			// pad the last block with white spaces
+			memset(padded, ' ', sizeof(padded));
+			memcpy(padded, block, length - offset);
+			block = padded;
+		}
+		BlockMasks masks;
+		classify(block, masks);
+
+		// the characters following an unescaped backslash are escaped,
+		// backslashes are rare so they are walked one by one
+		uint64_t escaped = 0;
+		uint64_t backslash = masks.backslash;
+		if (escape_carry) { escaped = 1; backslash &= ~static_cast<uint64_t>(1); }
+		escape_carry = false;
+		while (backslash)
+		{
+			unsigned i = CountTrailingZeros64(backslash);
+			if (63 == i) { escape_carry = true; break; }
+			escaped |= static_cast<uint64_t>(2) << i;
+			backslash &= ~(static_cast<uint64_t>(3) << i);
+		}
+		uint64_t quote = masks.quote & ~escaped;
+		// opening quotes and the characters in strings, closing quotes excluded
+		uint64_t in_string = PrefixXor(quote) ^ string_carry;
+		string_carry = static_cast<uint64_t>(static_cast<int64_t>(in_string) >> 63);
+		uint64_t op = masks.op & ~in_string;
+		uint64_t scalar = ~(masks.op | masks.space | quote | in_string);
+		uint64_t scalar_start = scalar & ~((scalar << 1) | scalar_carry);
+		scalar_carry = scalar >> 63;
+		uint64_t bits = op | (quote & in_string) | scalar_start;
+
+		if (structurals.size() < count + 64) { structurals.resize(2 * structurals.size() + 64); }
+		uint32_t* out = &structurals[count];
+		while (bits)
+		{
+			*out++ = static_cast<uint32_t>(offset + CountTrailingZeros64(bits));
+			bits &= bits - 1;
+		}
+		count = out - &structurals[0];
+	}
+	if (structurals.size() < count + 1) { structurals.resize(count + 1); }
+	structurals[count++] = static_cast<uint32_t>(length);
+	structurals.resize(count);
+} // end fn:BuildStructuralIndex
 
-Json* Json::Parser::ConsumeNumber()
+void Json::Parser::ExpectSeparator()
 {
-	TRACK("Json* Json::Parser::ConsumeNumber()");
-	token = "";
-	NextCharacter();
-	// negative
-	if ('-' == character) { Concat(); NextCharacter(); }
-	bool loop = true;
-	bool dot = false;
-	if (!isdigit(character)) { UnexpectedToken(); }
-	Concat(); // the first digit or after '-'
-	if ('0' == character) {  loop = false; }
-	while (loop) // * loop
+	const char* after = source + pos + 1;
+	if (after < end && !IsSpace(*after) && !IsOperator(*after)) { UnexpectedAt(after); }
+}
+
+void Json::Parser::ScanNumber(Number& number)
+{
+	TRACK("Json::Parser::Number Json::Parser::ScanNumber()");
+	const char* begin = source + pos + 1;
+	const char* p = begin;
+	const uint64_t kMaxUInt64 = ~static_cast<uint64_t>(0);
+	uint64_t mantissa = 0;	// the first 19 significant digits, 20 for a big integer part
+	int digits = 0;			// number of digits in mantissa
+	int exponent = 0;		// decimal exponent applied to mantissa
+	bool truncated = false;	// some non-zero digits did not fit in mantissa
+	bool integral = true;	// no fraction part and no exponent part
+	bool negative = ('-' == Peek(p));
+	if (negative) { ++p; }
+	if (!IsDigit(Peek(p))) { UnexpectedAt(p); }
+	if ('0' == *p)
 	{
-		if (!isdigit(NextCharacter())) { Retract(); break; }
-		Concat();
+		if (IsDigit(Peek(++p))) { UnexpectedAt(p); } // fix 000.3
 	}
-	if (isdigit(NextCharacter())) { UnexpectedToken(); } // fix 000.3
-	if ('.' == character) { Concat(); dot = true; }
-	if (dot) // met '.', at least need one digit
+	else
 	{
-		if (!isdigit(NextCharacter())) { UnexpectedToken(); }
-		Concat();
+		for (; IsDigit(Peek(p)); ++p)
+		{
+			unsigned digit = *p - '0';
+			if (digits < 19) { mantissa = mantissa * 10 + digit; ++digits; }
+			// a 20th digit still fits when the integer is below 18446744073709551616
+			else if (19 == digits && 0 == exponent && mantissa <= (kMaxUInt64 - digit) / 10)
+			{
+				mantissa = mantissa * 10 + digit;
+				++digits;
+			}
+			else { ++exponent; truncated = truncated || 0 != digit; }
+		}
 	}
-	while (dot) // * loop
+	if ('.' == Peek(p)) // met '.', at least need one digit
 	{
-		NextCharacter();
-		if (!isdigit(character)) { break; }
-		Concat();
+		integral = false;
+		if (!IsDigit(Peek(++p))) { UnexpectedAt(p); }
+		for (; IsDigit(Peek(p)); ++p)
+		{
+			if (0 == mantissa && '0' == *p) { --exponent; } // leading zeros are not significant
+			else if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); ++digits; --exponent; }
+			else { truncated = truncated || '0' != *p; }
+		}
 	}
 	// confront with scientific notation
-	if ('e' == character || 'E' == character)
+	if ('e' == Peek(p) || 'E' == Peek(p))
 	{
-		Concat();
-		NextCharacter();
-		if ('+' == character || '-' == character) { Concat(); }
-		else if (isdigit(character)) { Retract(); }
-		else { UnexpectedToken(); }
+		integral = false;
+		++p;
+		bool negative_exponent = ('-' == Peek(p));
+		if ('+' == Peek(p) || '-' == Peek(p)) { ++p; }
 		// at least need one digit after '+' or '-' or 'E' or 'e'
-		if (!isdigit(NextCharacter())) { UnexpectedToken(); }
-		Concat();
-		while (true)
+		if (!IsDigit(Peek(p))) { UnexpectedAt(p); }
+		int value = 0;
+		for (; IsDigit(Peek(p)); ++p)
 		{
-			NextCharacter();
-			// if (EOL() || isspace(character)) { break; }
-			if (!isdigit(character)) { Retract(); break; }
-			Concat();
+			if (value < 100000) { value = value * 10 + (*p - '0'); } // saturate, it's 0 or inf anyway
 		}
+		exponent += negative_exponent ? -value : value;
 	}
-	else
+	pos = p - source - 1;
+	character = ' ';
+	// integers which fit stay exact, -0 stays a double
+	if (integral && 0 == exponent && (!negative || (0 != mantissa && mantissa - 1 <= INT64_MAX)))
 	{
-		Retract();
+		if (negative) { number.type = kInt64; number.integer = -static_cast<int64_t>(mantissa - 1) - 1; }
+		else if (mantissa <= INT64_MAX) { number.type = kInt64; number.integer = static_cast<int64_t>(mantissa); }
+		else { number.type = kUInt64; number.unsigned_integer = mantissa; }
+		return;
 	}
-	// else if (EOL() || isspace(character)) { ; } 
-	// else { UnexpectedToken(); } // fix -23.0s
-	return new Json(atof(token.c_str()));
-} // end fn:ConsumeNumber
+	number.type = kDouble;
+	if (0 == mantissa) { number.value = 0.0; }
+	else if (!truncated && DecimalToDouble(mantissa, exponent, number.value)) { }
+	else { number.value = StringToDouble(begin + negative, p); }
+	if (negative) { number.value = -number.value; }
+} // end fn:ScanNumber
 
-Json* Json::Parser::ConsumeString()
+bool Json::Parser::ScanString()
 {
-	TRACK("Json* Json::Parser::ConsumeString()");
+	TRACK("bool Json::Parser::ScanString()");
 	SkipWhitespaces();
 	// consume the open quote
 	if ('\"' != NextCharacter()) { UnexpectedToken(); }
-	token = "";
+	ptrdiff_t begin = pos + 1;
+	bool escaped = false;
+	Scanner find_special = g_find_string_special.load(memory_order_relaxed);
 	while (true)
 	{
+		// jump over the plain characters to the next quote, escape or control character
+		const char* plain = source + pos + 1;
+		const char* special = find_special(plain, end);
+		if (escaped) { token.append(plain, special); }
+		pos = special - source - 1;
 		// meet the close quote, end loop
 		if ('\"' == NextCharacter()) { break; }
 		// the escape characters
 		if ('\\' == character)
 		{
-			Concat();
-			NextCharacter();
-			switch (character)
-			{
-				case '\"': case '\\': case '/': case 'b':
-				case 'f': case 'n': case 'r': case 't':
-				{
-					Concat();
-					break;
-				}
-				case 'u':
-				{
-					Concat();
-					for (int i = 0; i < 4; ++i)
-					{
-						if (!isxdigit(NextCharacter()))
-						{
-							UnexpectedToken();
-						}
-						Concat();
-					}
-					break;
-				}
-				default:
-				{
-					UnexpectedToken();
-					break;
-				}
-			}
+			// the characters before the first escape go to token as they are
+			if (!escaped) { token.assign(source + begin, pos - begin); escaped = true; }
+			ConsumeEscape();
 		}
-		else // if not a escape character
+		else // a control character, or the end of input
 		{
-			if (iscntrl(character)) { UnexpectedToken(); }
-			Concat();
+			UnexpectedToken();
 		}
 	}
-	return new Json(token);
-} // end fn:ConsumeString
-
-Json* Json::Parser::ConsumeBool()
-{
-	TRACK("Json* Json::Parser::ConsumeBool()");
-	char ch = NextCharacter();
-	Retract();
-	if ('t' == ch) { ConsumeSpecific("true"); return new Json(true); }
-	else { ConsumeSpecific("false"); return new Json(false); }
-} // end fn:ConsumeBool
-
-Json* Json::Parser::ConsumeNull()
-{
-	TRACK("Json* Json::Parser::ConsumeNull()");
-	ConsumeSpecific("null");
-	return new Json();
-} // end fn:ConsumeNull
+	if (escaped)
+	{
+		text = token.data();
+		text_size = token.size();
+		return false;
+	}
+	text = source + begin;
+	text_size = pos - begin;
+	return true;
+} // end fn:ScanString
 
-Json* Json::Parser::ConsumeObject()
+void Json::Parser::ConsumeEscape()
 {
-	TRACK("Json* Json::Parser::ConsumeObject()");
-	ObjectData *obj = new ObjectData();
-	if ('{' != NextCharacter()) { UnexpectedToken(); }
-	SkipWhitespaces();
-	if ('}' == NextCharacter()) { ; } // empty object
-	else // at least need one pair
+	NextCharacter();
+	switch (character)
 	{
-		Retract();
-		try { obj->insert(ConsumePair()); }
-		catch (exception& e)
+		case '\"': case '\\': case '/': Concat(); break;
+		case 'b': token += '\b'; break;
+		case 'f': token += '\f'; break;
+		case 'n': token += '\n'; break;
+		case 'r': token += '\r'; break;
+		case 't': token += '\t'; break;
+		case 'u':
 		{
-			Json::DestroyObjectData(*obj);
-			delete obj;
-			UnexpectedToken();
-		}
-		while (true) // * loop
-		{
-			if ('}' == NextCharacter()) { break; }
-			else if (',' == character)
-			{ 
-				try { obj->insert(ConsumePair()); }
-				catch (exception& e)
-				{
-					Json::DestroyObjectData(*obj);
-					delete obj;
-					UnexpectedToken();
-				}
+			unsigned code = 0;
+			for (int i = 0; i < 4; ++i)
+			{
+				if (!isxdigit(NextCharacter())) { UnexpectedToken(); }
+				code = (code << 4) | HexValue(character);
 			}
-			else
+			// a high surrogate followed by a low one makes a single code point
+			const char* next = source + pos + 1;
+			if (code >= 0xD800 && code < 0xDC00 && end - next >= 6 && '\\' == next[0] && 'u' == next[1]
+				&& isxdigit(next[2]) && isxdigit(next[3]) && isxdigit(next[4]) && isxdigit(next[5]))
 			{
-				Json::DestroyObjectData(*obj);
-				delete obj;
-				UnexpectedToken();
+				unsigned low = 0;
+				for (int i = 2; i < 6; ++i) { low = (low << 4) | HexValue(next[i]); }
+				if (low >= 0xDC00 && low < 0xE000)
+				{
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					pos += 6;
+				}
 			}
+			AppendUtf8(token, code);
+			break;
 		}
-	}
-	return new Json(obj);
-} // end fn:ConsumeObject
-
-Json* Json::Parser::ConsumeArray()
-{
-	TRACK("Json* Json::Parser::ConsumeArray()");
-	ArrayData *arr = new ArrayData();
-	if ('[' != NextCharacter()) { UnexpectedToken(); }
-	SkipWhitespaces();
-	if (']' == NextCharacter()) { ; } // empty array
-	else // at least one value
-	{
-		Retract();
-		try { arr->push_back(ConsumeValue()); }
-		catch (exception& e)
+		default:
 		{
-			Json::DestroyArrayData(*arr);
-			delete arr;
 			UnexpectedToken();
-		}
-		while (true) // * loop
-		{
-			if (']' == NextCharacter()) { break; }
-			else if (',' == character) {
-				try { arr->push_back(ConsumeValue()); }
-				catch(exception& e)
-				{
-					Json::DestroyArrayData(*arr);
-					delete arr;
-					UnexpectedToken();
-				}
-			}
-			else
-			{
-				Json::DestroyArrayData(*arr);
-				delete arr;
-				UnexpectedToken();
-			}
+			break;
 		}
 	}
-	return new Json(arr);
-} // end fn: Consume Array
-
-Json::Pair Json::Parser::ConsumePair()
-{
-	TRACK("Json::Parser::Pair Json::Parser::ConsumePair()");
-	Json* pkey = ConsumeString();
-	string key(pkey->AsString());
-	delete pkey;
-	SkipWhitespaces();
-	ConsumeSpecific(":");
-	Json *value = ConsumeValue();
-	return make_pair(key, value);
-} // end fn:ConsumePair
+} // end fn:ConsumeEscape
 
 void Json::Parser::ConsumeSpecific(const char* str)
 {
@@ -637,23 +4140,25 @@ Json::Kind Json::Parser::KindDetect()
 
 void Json::Parser::SkipWhitespaces()
 {
-	char ch;
-	while (true)
-	{
-		ch = NextCharacter();
-		if (' ' == ch || '\t' == ch || '\n' == ch || '\r' == ch) { ; }
-		else { pos--; break; }
-	}
+	const char* p = source + pos + 1;
+	// most of the time there is nothing or a single space to skip
+	if (p >= end || !IsSpace(*p)) { return; }
+	if (++p == end || !IsSpace(*p)) { pos++; return; }
+	p = g_skip_spaces.load(memory_order_relaxed)(p, end);
+	pos = p - source - 1;
 }
 
-void Json::Parser::UnexpectedToken() { throw Json::UnexpectedTokenException(character, pos); }
+void Json::Parser::UnexpectedToken() { throw Json::UnexpectedTokenException(character, pos, EOL()); }
 
 /* Json::UnexpectedTokenException */
-Json::UnexpectedTokenException::UnexpectedTokenException(char ch, int pos)
+Json::UnexpectedTokenException::UnexpectedTokenException(char ch, ptrdiff_t pos)
+	: UnexpectedTokenException(ch, pos, '\0' == ch) { }
+
+Json::UnexpectedTokenException::UnexpectedTokenException(char ch, ptrdiff_t pos, bool end_of_input)
 	:exception(), ch_(ch), pos_(pos)
 {
 	ostringstream oss;
-	if ('\0' == ch_)
+	if (end_of_input)
 	{
 		oss << "SyntaxError: Unexpected end of input";
 	}
@@ -667,6 +4172,14 @@ Json::UnexpectedTokenException::UnexpectedTokenException(char ch, int pos)
 	msg_ = oss.str();
 }
 
+Json::UnexpectedTokenException::UnexpectedTokenException(const UnexpectedTokenException& error, size_t line)
+	:exception(), ch_(error.ch_), pos_(error.pos_)
+{
+	ostringstream oss;
+	oss << error.msg_ << " on line " << line;
+	msg_ = oss.str();
+}
+
 Json::UnexpectedTokenException::~UnexpectedTokenException() throw() {}
 
 const char* Json::UnexpectedTokenException::what() const throw()
@@ -674,4 +4187,60 @@ const char* Json::UnexpectedTokenException::what() const throw()
 	return msg_.c_str();
 }
 
+/* Json::PatchException */
+Json::PatchException::PatchException(const char* reason, const std::string& pointer) : exception()
+{
+	msg_ = string("PatchError: ") + reason + " at \"" + pointer + "\"";
+}
+
+Json::PatchException::~PatchException() throw() {}
+
+const char* Json::PatchException::what() const throw()
+{
+	return msg_.c_str();
+}
+
+/* Json::EncodeException */
+Json::EncodeException::EncodeException(const char* reason) : exception()
+{
+	msg_ = string("EncodeError: ") + reason;
+}
+
+Json::EncodeException::~EncodeException() throw() {}
+
+const char* Json::EncodeException::what() const throw()
+{
+	return msg_.c_str();
+}
+
+/* Json::DecodeException */
+Json::DecodeException::DecodeException(const char* reason, size_t pos) : exception()
+{
+	ostringstream oss;
+	oss << "DecodeError: " << reason << " at pos " << pos;
+	msg_ = oss.str();
+}
+
+Json::DecodeException::~DecodeException() throw() {}
+
+const char* Json::DecodeException::what() const throw()
+{
+	return msg_.c_str();
+}
+
+/* Json::FileException */
+Json::FileException::FileException(const char* path, int error) : exception()
+{
+	ostringstream oss;
+	oss << "FileError: " << path << ": " << strerror(error);
+	msg_ = oss.str();
+}
+
+Json::FileException::~FileException() throw() {}
+
+const char* Json::FileException::what() const throw()
+{
+	return msg_.c_str();
+}
+
 }
@@ -9,11 +9,19 @@
 #define TRACK(DESC)
 #endif
 
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+#include <new>
+#include <atomic>
 #include <iostream>
-#include <typeinfo>
 #include <string>
 #include <vector>
-#include <map>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 
 namespace ggicci
 {
@@ -51,6 +59,29 @@ namespace ggicci
 			kArray		///< an array, eg. [ 1, 2, null, {"love": true} ]
 		};
 
+		/**
+		 * \brief Flags changing the way Parse() works, combine them with '|'.
+		 */
+		enum ParseFlag : unsigned
+		{
+			kParseDefault = 0,				///< copy every string into the Json objects
+			kParseStringViews = 1 << 0,		///< reference strings without escapes in the source
+			kParseStructuralIndex = 1 << 1,	///< use the two-stage structural index engine
+			kParseInternKeys = 1 << 2		///< share the characters of long keys, see Key
+		};
+
+		/**
+		 * \brief Combine ParseFlag values, the result is a ParseFlag again.
+		 *
+		 * The flags are a type of their own so that no integer converts to them: a
+		 * length given to Parse(const char*, size_t, ParseFlag) can never be taken
+		 * for flags by Parse(const char*, ParseFlag).
+		 */
+		friend inline ParseFlag operator | (ParseFlag lhs, ParseFlag rhs)
+		{
+			return static_cast<ParseFlag>(static_cast<unsigned>(lhs) | static_cast<unsigned>(rhs));
+		}
+
 		/**
 		 * \brief Parse a json structural string to get a Json object.
 		 *
@@ -74,6 +105,198 @@ namespace ggicci
 		 */
 		static Json Parse(const char* json_string);
 
+		/**
+		 * \brief Parse a json structural string with some ParseFlag.
+		 *
+		 * With kParseStringViews, string values and keys which have no escapes are
+		 * not copied. The Json objects keep pointers into \em json_string, so it
+		 * must outlive the result (and stay unmodified). Copying such a Json object
+		 * copies the characters, so the copy does not depend on \em json_string.
+		 * Short strings are always copied inline, escaped strings are unescaped.
+		 *
+		 * With kParseStructuralIndex, the source is parsed by another engine. A
+		 * first pass finds the positions of all the structural characters 64 bytes
+		 * at a time with SIMD, a second pass builds the Json objects by walking
+		 * these positions instead of every character. It builds the same Json, it
+		 * pays off on large inputs, and it is not limited by the depth of the stack.
+		 *
+		 * With kParseInternKeys, the keys longer than 15 characters are interned
+		 * like Key does: each distinct key is stored once for the whole process and
+		 * the members reference it, repeated long keys allocate nothing. Use it for
+		 * documents whose keys come from a fixed schema.
+		 * @param  json_string json structural string
+		 * @param  flags       ParseFlag values combined with '|'
+		 * @return             a Json instance
+		 *
+		 * \code{.cpp}
+		 * string line = ReadLine();
+		 * Json json = Json::Parse(line.c_str(), Json::kParseStringViews);
+		 * cout << json["message"].AsString() << endl; // copied from line here
+		 * \endcode
+		 */
+		static Json Parse(const char* json_string, ParseFlag flags);
+
+		/**
+		 * \brief Parse the \em size characters at \em data, no NUL terminator needed.
+		 *
+		 * Nothing after \em data + \em size is read, so a slice of a bigger buffer is
+		 * parsed where it is, without copying it. With kParseStringViews the Json
+		 * objects may point into \em data.
+		 * @param  data  json structural string, not NUL-terminated
+		 * @param  size  number of characters of \em data
+		 * @param  flags ParseFlag values combined with '|'
+		 * @return       a Json instance
+		 *
+		 * \code{.cpp}
+		 * const char* message = buffer + header_size;
+		 * Json json = Json::Parse(message, message_size);
+		 * \endcode
+		 */
+		static Json Parse(const char* data, size_t size, ParseFlag flags = kParseDefault);
+
+		/**
+		 * \brief Parse the json file at \em path.
+		 *
+		 * The file is mapped in memory (mmap, with sequential read ahead) and parsed
+		 * in place, it is never copied into a buffer. kParseStringViews is ignored
+		 * since the mapping is gone when ParseFile() returns.
+		 * \note It throws an exception if the file can not be opened or mapped.
+		 * @param  path  the file to parse
+		 * @param  flags ParseFlag values combined with '|'
+		 * @return       a Json instance
+		 */
+		static Json ParseFile(const char* path, ParseFlag flags = kParseDefault);
+
+		/**
+		 * \brief A parsed json document whose values live in one arena.
+		 * \see Json::Document
+		 */
+		class Document;
+
+		/**
+		 * \brief A handler of ParseEvents() ignoring every event.
+		 * \see Json::BaseHandler
+		 */
+		struct BaseHandler;
+
+		/**
+		 * \brief A parser fed with chunks of a json stream, it keeps its state in between.
+		 * \see Json::PushParser
+		 */
+		class PushParser;
+
+		/**
+		 * \brief A serializer writing Json objects into a string, a file or a buffer.
+		 * \see Json::Writer
+		 */
+		class Writer;
+
+		/**
+		 * \brief An interned object key with a precomputed hash, for repeated lookups.
+		 * \see Json::Key
+		 */
+		class Key;
+
+		/**
+		 * \brief A JSON Pointer (RFC 6901) parsed once, to find a nested value in one call.
+		 * \see Json::Pointer
+		 */
+		class Pointer;
+
+		/**
+		 * \brief Many Pointer objects found together in one walk of a Json object.
+		 * \see Json::Pointers
+		 */
+		class Pointers;
+
+		/**
+		 * \brief A pair of iterators, for range-based for loops.
+		 * \see Json::Range
+		 */
+		template <typename Iterator>
+		class Range;
+
+		/**
+		 * \brief A member of an object seen through Items(): a view of its key and its value.
+		 * \see Json::BasicItem
+		 */
+		template <typename Value>
+		struct BasicItem;
+		typedef BasicItem<Json> Item;
+		typedef BasicItem<const Json> ConstItem;
+
+		/**
+		 * \brief Iterator over the members of an object, giving BasicItem values.
+		 * \see Json::ItemIterator
+		 */
+		template <typename Value>
+		class ItemIterator;
+
+		/**
+		 * \brief Parse a json structural string into events, no Json object is built.
+		 *
+		 * \em handler receives the values in the order of the source (see BaseHandler
+		 * for the events). Every event returns true to go on, false to stop the parsing
+		 * at once. Syntax errors throw like Parse() does, once the events of what comes
+		 * before are sent. The handler is a template parameter, events are direct calls
+		 * which the compiler inlines, so the events a handler ignores cost nothing.
+		 * @param  json_string json structural string
+		 * @param  handler     receives the events
+		 * @param  flags       ParseFlag values combined with '|'
+		 * @return             false if \em handler stopped the parsing
+		 *
+		 * \code{.cpp}
+		 * struct SumIds : Json::BaseHandler
+		 * {
+		 * 	double sum;
+		 * 	bool is_id;
+		 * 	SumIds() : sum(0), is_id(false) { }
+		 * 	bool Key(const char* str, size_t size) { is_id = string(str, size) == "id"; return true; }
+		 * 	bool Number(double number) { if (is_id) { sum += number; } return true; }
+		 * };
+		 * SumIds handler;
+		 * Json::ParseEvents("[{\"id\": 1}, {\"id\": 2, \"tags\": [3]}]", handler);
+		 * cout << handler.sum << endl; // 3
+		 * \endcode
+		 */
+		template <typename Handler>
+		static bool ParseEvents(const char* json_string, Handler& handler, ParseFlag flags = kParseDefault);
+
+		/**
+		 * \brief Called by ParseLines() for every value, \em line counts from 0.
+		 */
+		typedef std::function<void (size_t line, Json& json)> LineCallback;
+
+		/**
+		 * \brief Parse newline-delimited json (one value per line) on several threads.
+		 *
+		 * \em data is cut into chunks of whole lines, the chunks are parsed by a pool
+		 * of \em threads workers (the number of cores if 0) which steal chunks from
+		 * each other when they run out. \em callback is called on the calling thread
+		 * with the values in the order of the lines, blank lines are skipped. Only a
+		 * few chunks per worker are parsed ahead of \em callback, so the memory in
+		 * use does not grow with \em size.
+		 *
+		 * A syntax error (or an exception from \em callback) stops the workers and is
+		 * thrown once the values of the lines before it are passed to \em callback.
+		 * The message tells the line, counting from 0 like \em callback, and the
+		 * position in it.
+		 * @param data     the lines, '\n' or "\r\n" terminated, the last one may be not
+		 * @param size     number of bytes of \em data
+		 * @param callback takes the values, it may move them away
+		 * @param threads  number of workers, 0 for the number of cores
+		 * @param flags    ParseFlag values combined with '|', kParseStringViews is ignored
+		 *
+		 * \code{.cpp}
+		 * size_t errors = 0;
+		 * Json::ParseLines(data, size, [&](size_t line, Json& json) {
+		 * 	if (json.Contains("error")) { ++errors; }
+		 * });
+		 * \endcode
+		 */
+		static void ParseLines(const char* data, size_t size, const LineCallback& callback,
+			unsigned threads = 0, ParseFlag flags = kParseDefault);
+
 		/**
 		 * \brief Construct a Json object represents null.
 		 * 
@@ -91,6 +314,16 @@ namespace ggicci
 		 */
 		explicit Json(int num);
 
+		/**
+		 * \brief Construct a Json object from a 64 bits integer, kept exact.
+		 */
+		explicit Json(int64_t num);
+
+		/**
+		 * \brief Construct a Json object from an unsigned 64 bits integer, kept exact.
+		 */
+		explicit Json(uint64_t num);
+
 		/**
 		 * \brief Construct a Json object from \b double.
 		 */
@@ -114,24 +347,53 @@ namespace ggicci
 		explicit Json(bool boo);
 
 		/**
-		 * \brief Deep copy constructor.
+		 * \brief Copy constructor, it takes a constant time.
+		 *
+		 * The containers and long strings of \em rhs are shared, not copied: a
+		 * container is copied only when one of the Json objects sharing it is
+		 * modified, and then only the containers on the path to the modification
+		 * are, one level each. The copy behaves like a deep copy otherwise, and
+		 * the reference counts are atomic, so copies may go to other threads.
+		 *
+		 * The references handed out by the non-const operator[], Items() and
+		 * Elements() are invalidated, like iterators, when their Json object is
+		 * copied or modified: take them again afterwards. The values of a
+		 * Document and the ones parsed with kParseStringViews are copied, not
+		 * shared, the copy does not depend on them.
 		 * @param rhs another Json object.
 		 */
 		Json(const Json& rhs);
 
 		/**
-		 * \brief Assignment, DO deep copy.
+		 * \brief Assignment, a copy like Json(const Json&).
 		 *
-		 * Copy everything from \em json to this Json object. And the old memory will be
-		 * changed or just deallocated. The current Json object will hold a copy of the
-		 * values of \em json.
+		 * The old value of this Json object is released, it holds a copy of the
+		 * value of \em rhs afterwards.
 		 */
 		Json& operator = (const Json& rhs);
 
+		/**
+		 * \brief Move constructor, steal the data of \em rhs.
+		 * @param rhs another Json object, it becomes null.
+		 */
+		Json(Json&& rhs) noexcept;
+
+		/**
+		 * \brief Assignment, steal the data of \em rhs without copying.
+		 *
+		 * The old memory of this Json object is deallocated and \em rhs becomes null.
+		 * \code{.cpp}
+		 * Json json;
+		 * json = Json::Parse("[1, 2, 3, 4]"); // no copy of the array
+		 * json["name"] = std::move(other); // other is null now
+		 * \endcode
+		 */
+		Json& operator = (Json&& rhs) noexcept;
+
 		/**
 		 * \brief Destructor to delete a Json object.
 		 */
-		virtual ~Json();
+		~Json();
 
 		/**
 		 * \brief Get the enum value of this Json object, which indicates
@@ -152,6 +414,16 @@ namespace ggicci
 		 */
 		bool IsNumber() const { return kind_ == kNumber; }
 
+		/**
+		 * \brief Test whether this Json object is a number held as an exact integer.
+		 *
+		 * Integers written without a fraction nor an exponent are parsed as 64 bits
+		 * integers when they fit (an unsigned one above INT64_MAX), and so are the
+		 * numbers constructed from integers. Other numbers are doubles.
+		 * @return true means AsInt64() (or AsUInt64()) gives the exact value
+		 */
+		bool IsInteger() const { return kind_ == kNumber && kDouble != storage_; }
+
 		/**
 		 * \brief Test whether this Json object represents a string.
 		 * @return true means it's a string
@@ -170,7 +442,7 @@ namespace ggicci
 		 * \see Json()
 		 * @return true means it's null
 		 */
-		bool IsNull() const { return !data_; }
+		bool IsNull() const { return kind_ == kNull; }
 
 		/**
 		 * \brief Test whether this Json object represents an array.
@@ -221,6 +493,58 @@ namespace ggicci
 		 */
 		bool Contains(const char* key) const;
 
+		/**
+		 * \brief Contains(const char*) with a Key, nothing is hashed.
+		 */
+		bool Contains(const Key& key) const;
+
+		/**
+		 * \brief Find the value of \em key without adding it.
+		 *
+		 * Find() never modifies the Json object nor allocates, even a non-const
+		 * one, so a Json object shared by many threads can be read through it
+		 * (and through the const operator[]) at the same time without locking,
+		 * as long as no thread modifies it. Use operator[] to modify the value.
+		 * @return the value, or null if this is not an object or has no such key
+		 *
+		 * \code{.cpp}
+		 * if (const Json* route = routes.Find(path)) { Forward(*route); }
+		 * \endcode
+		 */
+		const Json* Find(const char* key) const;
+
+		/**
+		 * \brief Find(const char*) with a Key, nothing is hashed.
+		 */
+		const Json* Find(const Key& key) const;
+
+		/**
+		 * \brief Find the value \em pointer refers to, without adding anything.
+		 *
+		 * The segments of \em pointer are looked up one after another: the members
+		 * of objects by their interned keys, nothing is hashed nor allocated, and
+		 * the elements of arrays by their indices, parsed once with \em pointer.
+		 * Like Find(const char*), it is safe from many threads at once.
+		 * @return the value, or null if a segment is missing
+		 *
+		 * \code{.cpp}
+		 * static const Json::Pointer kCity("/users/0/address/city");
+		 * if (const Json* city = json.Find(kCity)) { cout << city->AsString() << endl; }
+		 * \endcode
+		 */
+		const Json* Find(const Pointer& pointer) const;
+
+		/**
+		 * \brief Find the values of all the \em pointers in one walk.
+		 *
+		 * The segments the pointers share (like "/request/headers" of
+		 * "/request/headers/host" and "/request/headers/accept") are looked up
+		 * once. \em results is resized to pointers.Size(), its memory is reused
+		 * from call to call.
+		 * @param results set to the value of each pointer (see Pointers::Add()), or null
+		 */
+		void Find(const Pointers& pointers, std::vector<const Json*>& results) const;
+
 		/**
 		 * Indicate the size of the array.
 		 * @return size of the array, or 1 if it is not an array.
@@ -240,7 +564,7 @@ namespace ggicci
 		 *
 		 * If this Json object represents an object (parsed from "{...}"), it
 		 * will have some KVPs (or maybe none), then use this function you can
-		 * retrieve all the keys (names) in a std::vector.
+		 * retrieve all the keys (names) in a std::vector, in insertion order.
 		 * \note An empty vector will be returned if it's not an object Json object.
 		 * @return a std::vector contains all the keys
 		 * 
@@ -255,13 +579,49 @@ namespace ggicci
 		 * \endcode
 		 * \b Output:
 		 * \code{.txt}
-		 * birthday: [ 1991, 11, 10 ]
 		 * id: 1234
 		 * name: "Ggicci"
+		 * birthday: [ 1991, 11, 10 ]
 		 * \endcode
+		 * \note Items() walks the members without copying the keys nor looking them up.
 		 */
 		std::vector<std::string> Keys() const;
 
+		/**
+		 * \brief The members of an object, in insertion order, for a range-based for loop.
+		 *
+		 * Each member is given as an Item: a view of the characters of its key and
+		 * a reference to its value. Nothing is copied nor allocated, and no key is
+		 * looked up, unlike Keys() followed by operator[]. The values may be
+		 * modified, adding or removing members, or copying this Json object,
+		 * invalidates the range.
+		 * @return the members, none if this Json object is not an object
+		 *
+		 * \code{.cpp}
+		 * for (const Json::ConstItem& item : json.Items())
+		 * {
+		 * 	cout << string(item.key, item.key_size) << ": " << item.value.ToString() << endl;
+		 * }
+		 * \endcode
+		 */
+		Range<ItemIterator<Json> > Items();
+		Range<ItemIterator<const Json> > Items() const;
+
+		/**
+		 * \brief The elements of an array, for a range-based for loop.
+		 *
+		 * The iterators are plain pointers to the elements, which are stored one
+		 * after another. Pushing or removing elements, or copying this Json
+		 * object, invalidates the range.
+		 * @return the elements, none if this Json object is not an array
+		 *
+		 * \code{.cpp}
+		 * for (const Json& tag : json["tags"].Elements()) { cout << tag.AsString() << endl; }
+		 * \endcode
+		 */
+		Range<Json*> Elements();
+		Range<const Json*> Elements() const;
+
 		/**
 		 * \brief Push a Json object to the current Json object (finally an array).
 		 *
@@ -270,6 +630,8 @@ namespace ggicci
 		 * If current Json object is an array, just simply push back \em rhs.
 		 * Otherwise, an exception will be thrown.
 		 * \note An exception may be thrown to indicate that it's a bad operation.
+		 * \note The elements are stored by value, a push may move them and invalidate
+		 * 		 the references to them.
 		 * @param  rhs the Json object to push
 		 * @return     The Json object finally got
 		 * 
@@ -284,6 +646,18 @@ namespace ggicci
 		 */
 		Json& Push(const Json& rhs);
 
+		/**
+		 * \brief Push a Json object to the current Json object without copying it.
+		 *
+		 * Same as Push(const Json&), but the data of \em rhs is stolen and \em rhs
+		 * becomes null.
+		 * \code{.cpp}
+		 * Json json = Json::Parse("[]");
+		 * json.Push(Json::Parse("{\"id\": 1}")); // no copy of the object
+		 * \endcode
+		 */
+		Json& Push(Json&& rhs);
+
 		/**
 		 * \brief AddProperty a Json object to the current Json object (finally an object).
 		 *
@@ -303,12 +677,20 @@ namespace ggicci
 		 * json.AddProperty("characteristics", Json::Parse("[\"optimitic\", \"sympathetic\"]"));
 		 * cout << json.ToString() << endl;
 		 * // output:
-		 * // { "characteristics": [ "optimitic", "sympathetic" ], "name": "Ggicci" }
+		 * // { "name": "Ggicci", "characteristics": [ "optimitic", "sympathetic" ] }
 		 * \endcode
 		 * 
 		 */
 		Json& AddProperty(const std::string& key, const Json& value);
 
+		/**
+		 * \brief AddProperty a Json object to the current Json object without copying it.
+		 *
+		 * Same as AddProperty(const std::string&, const Json&), but the data of \em value
+		 * is stolen and \em value becomes null.
+		 */
+		Json& AddProperty(const std::string& key, Json&& value);
+
 		/**
 		 * \brief Remove a specefied KVP(key-value pair) from an object Json object by key(name).
 		 *
@@ -354,11 +736,33 @@ namespace ggicci
 		 */
 		int AsInt() const;
 
+		/**
+		 * \brief Extract the data from number Json object and return it as \b int64_t.
+		 *
+		 * Integers are exact, doubles are truncated toward zero.
+		 * \note Exception when Json object is not a number, or out of the range of int64_t.
+		 */
+		int64_t AsInt64() const;
+
+		/**
+		 * \brief Extract the data from number Json object and return it as \b uint64_t.
+		 *
+		 * Integers are exact, doubles are truncated toward zero.
+		 * \note Exception when Json object is not a number, or out of the range of uint64_t.
+		 */
+		uint64_t AsUInt64() const;
+
 		/**
 		 * \brief Extract the data from number Json object and return it as \b double.
 		 * \note Exception when Json object is not a number.
 		 */
-		double AsDouble() const;
+		double AsDouble() const
+		{
+			Expect(kNumber);
+			if (kInt64 == storage_) { return static_cast<double>(value_.integer); }
+			if (kUInt64 == storage_) { return static_cast<double>(value_.unsigned_integer); }
+			return value_.number;
+		}
 
 		/**
 		 * \brief Extract the data from bool Json object and return it as \b bool.
@@ -385,32 +789,63 @@ namespace ggicci
 		 * Json json = Json::Parse("[1, 2, 3 ,4]");
 		 * json[1] = "hello"; // [1, "hello", 3, 4]
 		 * \endcode
+		 * \note The reference is invalidated when this Json object is copied or
+		 * 		 modified, see Json(const Json&).
 		 */
 		Json& operator[] (int index);
 
 		/**
 		 * \brief Extract the item data from an object by specified a key(name).
 		 * Return the reference.
+		 *
+		 * A missing key gives a null Json object and is not added: a const lookup
+		 * never modifies the object, it is safe from many threads at once (see Find()).
 		 * \note Exception when Json object is not an object.
 		 */
 		const Json& operator[] (const char* key) const;
 
 		/**
 		 * \brief Extract the item data from an object by specified a key(name).
-		 * Return the reference.
+		 * Return the reference, a missing key is added with a null value.
 		 * \note Exception when Json object is not an object.
 		 * \code{.cpp}
 		 * Json json = Json::Parse("{\"author\": \"Ggicci\", \"sex\": 0}");
 		 * json["sex"] = 1; // { "author": "Ggicci", "sex": 1 }
 		 * \endcode
+		 * \note Adding a key may move the other values of the object, do not keep
+		 * 		 a reference to one of them across it.
 		 */
 		Json& operator[] (const char* key);
 
+		/**
+		 * \brief operator[](const char*) const with a Key: a lookup hashes and allocates nothing.
+		 *
+		 * A missing key gives a null Json object and is not added.
+		 */
+		const Json& operator[] (const Key& key) const;
+
+		/**
+		 * \brief operator[](const char*) with a Key: a lookup hashes and allocates nothing.
+		 *
+		 * A missing key is added with the interned characters of \em key.
+		 */
+		Json& operator[] (const Key& key);
+
 		/**
 		 * \brief Assignment from \b int, finally become a number.
 		 */
 		Json& operator = (int num);
 
+		/**
+		 * \brief Assignment from a 64 bits integer, finally become an exact integer.
+		 */
+		Json& operator = (int64_t num);
+
+		/**
+		 * \brief Assignment from an unsigned 64 bits integer, finally become an exact integer.
+		 */
+		Json& operator = (uint64_t num);
+
 		/**
 		 * \brief Assignment from \b double, finally become a number.
 		 */
@@ -433,117 +868,533 @@ namespace ggicci
 		 */
 		Json& operator = (bool boo);
 
+		/**
+		 * \brief The JSON Patch (RFC 6902) which turns \em from into \em to.
+		 *
+		 * The patch is an array of operations, to send instead of the whole \em to
+		 * when \em from is known on the other side. The values are compared from
+		 * the top, identical branches are skipped at once: the containers shared
+		 * by copies (see Json(const Json&)) by their address, the others by their
+		 * structural hashes, which are computed once and kept in the containers.
+		 * In arrays, the elements which only moved are sent as "move" operations,
+		 * the changed ones as the patch of the change.
+		 * @return the patch, an empty array if the values are equal
+		 *
+		 * \code{.cpp}
+		 * Json config = Load();
+		 * Json next = config;
+		 * next["limits"]["rate"] = 200;
+		 * Send(Json::Diff(config, next).ToString());
+		 * // [ { "op": "replace", "path": "/limits/rate", "value": 200 } ]
+		 * \endcode
+		 */
+		static Json Diff(const Json& from, const Json& to);
+
+		/**
+		 * \brief Apply a JSON Patch (RFC 6902) to this Json object.
+		 *
+		 * The operations "add", "remove", "replace", "move", "copy" and "test"
+		 * are applied in order. The values are modified in place: only the
+		 * containers on the paths of the operations are touched, and the values
+		 * of the patch are shared rather than copied. Either the whole patch is
+		 * applied or none of it: the values the operations replace or remove are
+		 * kept, and put back in reverse order if one of them fails.
+		 * \note An exception is thrown if an operation fails (a missing path, a
+		 * 		 failed "test") or is not well formed, this Json object is unchanged.
+		 * @param  patch an array of operations
+		 * @return       this Json object, patched
+		 */
+		Json& ApplyPatch(const Json& patch);
+
+		/**
+		 * \brief Whether this Json object and \em rhs are the same value, down to the last element.
+		 *
+		 * Numbers are compared by value (1 == 1.0) and objects regardless of the
+		 * order of their members. The comparison stops at the first difference,
+		 * at the containers shared by copies (see Json(const Json&)), and at the
+		 * containers whose hashes are known (see Hash()) and differ.
+		 *
+		 * \code{.cpp}
+		 * Json::Parse("{\"a\": 1, \"b\": [true]}") == Json::Parse("{ \"b\": [true], \"a\": 1.0 }"); // true
+		 * \endcode
+		 */
+		bool operator == (const Json& rhs) const { return Equal(*this, rhs); }
+		bool operator != (const Json& rhs) const { return !Equal(*this, rhs); }
+
+		/**
+		 * \brief The structural hash of this Json object: equal values (see operator==) hash the same.
+		 *
+		 * The hash of an array or an object is computed once and kept in it, until
+		 * it is modified, so hashing again, or hashing a value which contains it,
+		 * does not walk it again. The containers which references were handed out
+		 * into (by the non-const operator[], Items() or Elements()) are the exception:
+		 * they may be modified behind them, their hash is computed every time
+		 * until they are copied.
+		 * \note Json objects can be the keys of the unordered containers: \c std::hash<Json>
+		 * 		 is Hash().
+		 *
+		 * \code{.cpp}
+		 * std::unordered_set<Json> seen;
+		 * if (!seen.insert(document).second) { return; } // a duplicate
+		 * \endcode
+		 */
+		uint64_t Hash() const;
+
+		/**
+		 * \brief Merge a JSON Merge Patch (RFC 7386) into this Json object.
+		 *
+		 * The members of an object \em patch are merged into the members of the
+		 * same keys, recursively, its null members remove them. Any other \em patch
+		 * replaces this Json object. The values of \em patch are moved in, not
+		 * copied, and nothing is allocated for the keys already there. \em patch
+		 * is null afterwards.
+		 * @param  patch the patch, e.g. an override of a configuration
+		 * @return       this Json object, patched
+		 *
+		 * \code{.cpp}
+		 * Json config = Json::Parse("{\"log\": {\"level\": \"info\", \"file\": \"a.log\"}, \"port\": 80}");
+		 * config.MergePatch(Json::Parse("{\"log\": {\"level\": \"debug\", \"file\": null}}"));
+		 * // { "log": { "level": "debug" }, "port": 80 }
+		 * \endcode
+		 */
+		Json& MergePatch(Json&& patch);
+
 		/**
 		 * \brief Get the json structural string of this Json object.
 		 *
 		 * For example, if this Json object represents an object, and it has
 		 * a KVP named "id" and its value is 194024, then you will get a json
-		 * string like this: <b>{ "id": 194024 }</b>.
+		 * string like this: <b>{ "id": 194024 }</b>. Numbers are written with the
+		 * shortest digits which read back exactly, infinities and NaN as null.
+		 * \note It is a Writer into a string, use a Writer to write into a file
+		 * 		 or to reuse a string.
 		 * @return the json structural string
 		 */
 		std::string ToString() const;
 
-	private:
-		#define CAST_JSON_OBJ(DATA) (static_cast<ObjectData*>(DATA))
-		#define CAST_JSON_ARR(DATA) (static_cast<ArrayData*>(DATA))
+		/**
+		 * \brief Encode this Json object in MessagePack.
+		 *
+		 * Integers take the fewest bytes which hold them, doubles which a float
+		 * holds exactly take 4 bytes, strings, arrays and objects (maps) are
+		 * prefixed with their length.
+		 * \note An exception is thrown for a string, an array or an object longer
+		 * 		 than 0xffffffff, MessagePack has no head for them.
+		 * @return the MessagePack bytes
+		 *
+		 * \code{.cpp}
+		 * string bytes = Json::Parse("{\"compact\": true, \"schema\": 0}").ToMsgPack();
+		 * // 82 a7 63 6f 6d 70 61 63 74 c3 a6 73 63 68 65 6d 61 00
+		 * \endcode
+		 */
+		std::string ToMsgPack() const;
+
+		/**
+		 * \brief Decode the \em size bytes of MessagePack at \em data.
+		 *
+		 * The values are built straight into Json objects, and the arrays and
+		 * objects are sized up front from their length prefixes. With
+		 * kParseStringViews, the strings are not copied: the Json objects point
+		 * into \em data, which must outlive them (see Parse(const char*, ParseFlag)).
+		 * With kParseInternKeys, long keys are interned. Binary data (bin) is
+		 * decoded as strings.
+		 * \note An exception is thrown if the data is cut, has a type JSON does not
+		 * 		 have (extensions, keys which are not strings), or more bytes follow.
+		 * @param  data  MessagePack bytes
+		 * @param  size  number of bytes of \em data
+		 * @param  flags ParseFlag values combined with '|'
+		 * @return       a Json instance
+		 */
+		static Json FromMsgPack(const char* data, size_t size, ParseFlag flags = kParseDefault);
 
-		typedef std::vector<Json*> ArrayData;
-		typedef std::map<std::string, Json*> ObjectData;
-		typedef std::pair<std::string, Json*> Pair;
+		/**
+		 * \brief Encode this Json object in CBOR (RFC 8949).
+		 *
+		 * Like ToMsgPack(): the shortest heads, doubles which a float holds
+		 * exactly in 4 bytes, and definite lengths.
+		 * @return the CBOR bytes
+		 */
+		std::string ToCbor() const;
 
 		/**
-		 * \brief A nested struct who does the real parsing job.
-		 * 
-		 * Firstly, I want to use static functions for doing
-		 * the same job. However, it is annoying to pass arguments
-		 * between different functions in order to keep the library
-		 * \b thread-safe.
+		 * \brief Decode the \em size bytes of CBOR (RFC 8949) at \em data.
+		 *
+		 * Like FromMsgPack(), indefinite lengths are read too. Byte strings are
+		 * decoded as strings, undefined as null, and tags are skipped (the tagged
+		 * value is decoded).
+		 * \note An exception is thrown if the data is cut, has a type JSON does not
+		 * 		 have (simple values, keys which are not strings), or more bytes follow.
+		 * @param  data  CBOR bytes
+		 * @param  size  number of bytes of \em data
+		 * @param  flags ParseFlag values combined with '|'
+		 * @return       a Json instance
 		 */
-		struct Parser
+		static Json FromCbor(const char* data, size_t size, ParseFlag flags = kParseDefault);
+
+	private:
+		/**
+		 * \brief A bump-pointer allocator which hands out memory from big blocks.
+		 *
+		 * Nothing allocated from an arena is freed on its own. All the blocks are
+		 * released together when the arena is reset or destroyed, so a whole parsed
+		 * tree can be thrown away without walking it.
+		 */
+		class Arena
 		{
-			const char* source;		///< the json structural string need to be parsed
-			int			pos;		///< current position(index) of the character in \em source
-			unsigned char character;///< current character scanned at
-			std::string	token;		///< appear as a word, finally it will be parsed to correspoding
-									///< data structure
-									///< ~~~
-									///< +---------+---+----------+---+---------+---+
-									///< | source  | [ | 112.4e+3 | , | "hello" | ] |
-									///< +---------+---+----------+---+---------+---+
-									///< | tokens  |   |  token   |   |  token  |   |
-									///< +---------+---+----------+---+---------+---+
-									///< ~~~
+		public:
+			Arena();
+			~Arena();
 
 			/**
-			 * Constructor
+			 * \brief Allocate \em size bytes aligned to \em alignment (a power of 2).
 			 */
-			Parser(const char* json_string);
+			void* Allocate(size_t size, size_t alignment);
 
 			/**
-			 * \brief Parse a \b Value.
+			 * \brief Forget everything allocated, keep the largest block for reuse.
+			 */
+			void Reset();
+
+		private:
+			struct Block
+			{
+				Block* next;	///< the block allocated before this one
+				size_t size;	///< usable bytes following the header
+			};
+
+			static const size_t kMinBlockSize = 4096;
+			static const size_t kMaxBlockSize = 1 << 20;
+
+			Arena(const Arena&);
+			Arena& operator = (const Arena&);
+
+			void NewBlock(size_t min_size);
+			void FreeBlocks(Block* block);
+
+			Block* blocks_;			///< the current block, others are chained behind it
+			char* cursor_;			///< next free byte in the current block
+			char* limit_;			///< end of the current block
+			size_t next_size_;		///< size of the next block to allocate
+		};
+
+		/**
+		 * \brief Standard allocator adaptor over Arena.
+		 *
+		 * A null arena means the global heap, so containers of a heap Json and
+		 * of an arena Json share the same types. Copies always land on the
+		 * heap (see select_on_container_copy_construction), which makes copying a
+		 * value out of a Document safe after the Document is gone.
+		 */
+		template <typename T>
+		struct ArenaAllocator
+		{
+			typedef T value_type;
+
+			ArenaAllocator(Arena* a = 0) : arena(a) { }
+			template <typename U>
+			ArenaAllocator(const ArenaAllocator<U>& rhs) : arena(rhs.arena) { }
+
+			T* allocate(size_t n)
+			{
+				if (arena) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+				return static_cast<T*>(::operator new(n * sizeof(T)));
+			}
+			void deallocate(T* p, size_t) { if (!arena) { ::operator delete(p); } }
+			ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+			template <typename U>
+			bool operator == (const ArenaAllocator<U>& rhs) const { return arena == rhs.arena; }
+			template <typename U>
+			bool operator != (const ArenaAllocator<U>& rhs) const { return arena != rhs.arena; }
+
+			Arena* arena;	///< where the memory comes from, null for the heap
+		};
+
+		/**
+		 * \brief The number of Json objects sharing a container or a string on the heap.
+		 *
+		 * Copying a Json object shares its containers and long strings instead of
+		 * copying them, a container is copied (one level deep) when a Json object
+		 * sharing it is about to modify it, see Unshare(). A container whose
+		 * elements were handed out by reference is exposed, see Expose().
+		 */
+		struct RefCount
+		{
+			RefCount() : count(1), borrowed(false), exposed(false) { }
+			RefCount(const RefCount&) : count(1), borrowed(false), exposed(false) { }	///< a copy starts unshared
+			RefCount& operator = (const RefCount&) { return *this; }
+
+			bool Unique() const { return 1 == count.load(std::memory_order_acquire); }
+			void AddRef() { count.fetch_add(1, std::memory_order_relaxed); }
+			bool DropRef() { return 1 == count.fetch_sub(1, std::memory_order_acq_rel); } ///< true for the last one
+
+			std::atomic<uint32_t> count;	///< number of Json objects holding it
+			std::atomic<bool> borrowed;		///< never shared: holds views of the input (kParseStringViews)
+			std::atomic<bool> exposed;		///< references into it may be held, see Settled()
+		};
+
+		/**
+		 * \brief The structural hash of a container, computed once, 0 until then.
+		 * \note Unshare() clears it before a modification, and borrowed or exposed
+		 * 		 containers do not keep it since their values may change behind them.
+		 */
+		struct HashCache
+		{
+			HashCache() : value(0) { }
+			HashCache(const HashCache&) : value(0) { }
+			HashCache& operator = (const HashCache&) { return *this; }
+
+			mutable std::atomic<uint64_t> value;
+		};
+
+		class ArrayData;
+		class ObjectData;
+
+		/**
+		 * \brief How a string Json object stores its characters.
+		 */
+		enum Storage
+		{
+			kInline,		///< in the Json object itself, at most kInlineCapacity characters
+			kAllocated,		///< in a buffer allocated from an arena, freed with it
+			kView,			///< in the parsed source, see kParseStringViews
+			kInterned,		///< in the key table, never freed, see Key
+			kShared			///< in a buffer on the heap after a RefCount, shared by the copies
+		};
+
+		static const size_t kInlineCapacity = 15;	///< the longest string stored inline
+
+		/**
+		 * \brief How a number Json object stores its value, in \em storage_.
+		 */
+		enum NumberType
+		{
+			kDouble,		///< in \em value_.number
+			kInt64,			///< in \em value_.integer
+			kUInt64			///< in \em value_.unsigned_integer, above INT64_MAX
+		};
+
+		/**
+		 * \brief The data held by a Json object, \em kind_ tells which member is in use.
+		 *
+		 * Numbers, bools and short strings live in the Json object itself, only
+		 * long strings and containers are allocated.
+		 */
+		union Value
+		{
+			double number;						///< kNumber, kDouble
+			int64_t integer;					///< kNumber, kInt64
+			uint64_t unsigned_integer;			///< kNumber, kUInt64
+			bool boolean;						///< kBool
+			char chars[kInlineCapacity + 1];	///< kString stored inline, NUL-terminated
+			struct
+			{
+				const char* data;				///< the characters, NUL-terminated unless a view
+				size_t size;					///< number of characters
+			} text;								///< kString stored in a buffer or viewed
+			ArrayData* array;					///< kArray
+			ObjectData* object;					///< kObject
+		};
+
+		/**
+		 * \brief A nested struct who does the real parsing job.
+		 * 
+		 * Firstly, I want to use static functions for doing
+		 * the same job. However, it is annoying to pass arguments
+		 * between different functions in order to keep the library
+		 * \b thread-safe.
+		 *
+		 * The grammar sends events to a handler (see BaseHandler), it builds
+		 * nothing itself. Json objects are built by the Builder handler.
+		 */
+		struct Parser
+		{
+			const char* source;		///< the json structural string need to be parsed
+			const char* end;		///< the terminating '\0' of \em source
+			ptrdiff_t	pos;		///< current position(index) of the character in \em source, -1 before the first one
+			unsigned char character;///< current character scanned at
+			std::string	token;		///< appear as a word, finally it will be parsed to correspoding
+									///< data structure
+									///< ~~~
+									///< +---------+---+----------+---+---------+---+
+									///< | source  | [ | 112.4e+3 | , | "hello" | ] |
+									///< +---------+---+----------+---+---------+---+
+									///< | tokens  |   |  token   |   |  token  |   |
+									///< +---------+---+----------+---+---------+---+
+									///< ~~~
+			unsigned	flags;		///< ParseFlag values
+			const char*	text;		///< characters of the last scanned string, in \em source or \em token
+			size_t		text_size;	///< number of characters of \em text
+
+			/**
+			 * Constructor
+			 */
+			Parser(const char* json_string, unsigned flags = kParseDefault);
+
+			/**
+			 * \brief Constructor for the \em size characters at \em data, not NUL-terminated.
+			 */
+			Parser(const char* data, size_t size, unsigned flags);
+
+			/**
+			 * \brief Parse another string of \em size characters, not NUL-terminated.
+			 * \note Keeps the memory of \em token and \em structurals for reuse.
+			 */
+			void Reset(const char* json_string, size_t size);
+
+			/**
+			 * \brief Parse the whole \em source with the engine chosen by \em flags.
+			 * @return false if \em handler stopped the parsing
+			 */
+			template <typename Handler>
+			bool ParseDocument(Handler& handler);
+
+			/**
+			 * \brief Stage one of kParseStructuralIndex, fill \em structurals.
 			 *
-			 * Value is a general term. A value maybe a string, number, object, array, bool, null.
-			 * ![value](value.gif "value")
-			 * \note All the consume functions will throw an exception when syntax error occurs
-			 * 		 in the \en source string.
-			 * @param  section whether global, it will check the end of the input when global
-			 * @return         the Json object parsed from \em source (maybe from substring)
+			 * Classify 64 bytes at a time into bitmasks (quotes, backslashes, white
+			 * spaces, operators), then strip escaped quotes and the characters inside
+			 * strings with bit operations. What is left: the operators {}[]:, outside
+			 * strings, the opening quotes and the first character of other tokens.
 			 */
-			Json* ConsumeValue(bool section = true);
+			void BuildStructuralIndex();
 
 			/**
-			 * \brief Parse a \b number.
-			 * 
-			 * ![number](number.gif "number")
-			 * @return the number Json object parsed
+			 * \brief Stage two of kParseStructuralIndex, walk \em structurals.
+			 * \note Containers are tracked by an explicit stack, not by recursion.
+			 * @return false if \em handler stopped the parsing
 			 */
-			Json* ConsumeNumber();
+			template <typename Handler>
+			bool ParseIndexed(Handler& handler);
 
 			/**
-			 * \brief Parse a \b string.
-			 * 
-			 * ![string](string.gif "string")
-			 * @return the string Json object parsed
+			 * \brief Parse the key at \em *next and the following ':' (stage two).
+			 * \note \em next is left at the value of the pair.
 			 */
-			Json* ConsumeString();
+			template <typename Handler>
+			bool ParseKeyAt(const uint32_t*& next, Handler& handler);
 
 			/**
-			 * \brief Parse a \b bool(true or false).
-			 * @return the bool Json object parsed
+			 * \brief Throw unless the token just scanned is followed by a white space,
+			 * an operator or the end (stage two).
 			 */
-			Json* ConsumeBool();
+			void ExpectSeparator();
 
 			/**
-			 * \brief Parse a \b null.
-			 * @return the null Json object parsed
+			 * \brief Positions of the structural characters found by BuildStructuralIndex(),
+			 * terminated by the position of \em end.
 			 */
-			Json* ConsumeNull();
+			std::vector<uint32_t> structurals;
 
 			/**
-			 * \brief Parse an \b object.
-			 * 
-			 * ![object](object.gif "object")
-			 * @return the object Json object parsed
+			 * \brief Parse a \b Value.
+			 *
+			 * Value is a general term. A value maybe a string, number, object, array, bool, null.
+			 * ![value](value.gif "value")
+			 * \note All the parse functions will throw an exception when syntax error occurs
+			 * 		 in the \en source string.
+			 * @return false if \em handler stopped the parsing
 			 */
-			Json* ConsumeObject();
+			template <typename Handler>
+			bool ParseValue(Handler& handler);
 
 			/**
-			 * \brief Parse an \b array.
+			 * \brief Parse a \b string, \b number, \b bool or \b null.
 			 * 
-			 * ![array](array.gif "array")
-			 * @return the array Json object parsed
+			 * ![string](string.gif "string") ![number](number.gif "number")
+			 * @return false if \em handler stopped the parsing
 			 */
-			Json* ConsumeArray();
+			template <typename Handler>
+			bool ParseScalar(Handler& handler);
 
 			/**
-			 * \brief Parse a \b pair of an \b object.
+			 * \brief Parse an \b object and its \b pairs.
 			 * 
 			 * Object of a Json consists of zero or more pairs. Ref :
 			 * <a href="www.json.org">json.org</a>
 			 * ![object](object.gif "object")
-			 * @return the pair parsed
+			 * @return false if \em handler stopped the parsing
+			 */
+			template <typename Handler>
+			bool ParseObject(Handler& handler);
+
+			/**
+			 * \brief Parse an \b array.
+			 * 
+			 * ![array](array.gif "array")
+			 * @return false if \em handler stopped the parsing
 			 */
-			Json::Pair ConsumePair();
+			template <typename Handler>
+			bool ParseArray(Handler& handler);
+
+			/**
+			 * \brief A number literal scanned from the \em source.
+			 */
+			struct Number
+			{
+				NumberType type;					///< kInt64 or kUInt64 for an integer which fits
+				union
+				{
+					double value;					///< kDouble, the double closest to the literal
+					int64_t integer;				///< kInt64
+					uint64_t unsigned_integer;		///< kUInt64
+				};
+			};
+
+			/**
+			 * \brief Send \em number to \em handler, integers to its Int64() and UInt64() if it has them.
+			 */
+			template <typename Handler>
+			static bool EmitNumber(Handler& handler, const Number& number);
+
+			/**
+			 * \brief Overloads picked by EmitNumber(): the first one when Handler has the event.
+			 */
+			template <typename Handler>
+			static auto EmitInteger(Handler& handler, int64_t integer, int) -> decltype(handler.Int64(integer))
+			{
+				return handler.Int64(integer);
+			}
+			template <typename Handler>
+			static bool EmitInteger(Handler& handler, int64_t integer, long)
+			{
+				return handler.Number(static_cast<double>(integer));
+			}
+			template <typename Handler>
+			static auto EmitInteger(Handler& handler, uint64_t integer, int) -> decltype(handler.UInt64(integer))
+			{
+				return handler.UInt64(integer);
+			}
+			template <typename Handler>
+			static bool EmitInteger(Handler& handler, uint64_t integer, long)
+			{
+				return handler.Number(static_cast<double>(integer));
+			}
+
+			/**
+			 * \brief Scan a \b number in a single pass, without the locale.
+			 *
+			 * The significant digits are accumulated while scanning. Integers which
+			 * fit in 64 bits are kept as they are, short decimals are converted
+			 * exactly from the digits, only the hard cases (more than 19 digits or
+			 * huge exponents) fall back to strtod.
+			 * @param number set to the number scanned
+			 */
+			void ScanNumber(Number& number);
+
+			/**
+			 * \brief Scan a quoted string in the \em source, set \em text to its characters.
+			 *
+			 * The characters are left in \em source if there are no escapes, otherwise
+			 * they are unescaped into \em token.
+			 * @return true if \em text points into \em source
+			 */
+			bool ScanString();
+
+			/**
+			 * \brief Unescape the escape sequence at the current \em character into \em token.
+			 */
+			void ConsumeEscape();
 
 			/**
 			 * \brief Consume a specified string in the \em source.
@@ -570,10 +1421,11 @@ namespace ggicci
 			void Retract() { pos--; character = ' '; }
 
 			/**
-			 * \brief Whether it is the end-of-line.
+			 * \brief Whether the current position is past the last character of \em source.
+			 * \note Decided by the position: a '\0' inside \em source is an unexpected token.
 			 * @return true if EOL.
 			 */
-			bool EOL() const { return '\0' == character; }
+			bool EOL() const { return pos >= end - source; }
 
 			/**
 			 * \brief Scan forward a step(one character distance).
@@ -581,13 +1433,20 @@ namespace ggicci
 			 */
 			char NextCharacter()
 			{
-				if (pos >= 0 && '\0' == *(source + pos)) { UnexpectedToken(); }
-				character = *(source + (++pos));
+				if (pos >= 0 && source + pos >= end) { UnexpectedToken(); }
+				character = Peek(source + (++pos));
 				return character;
 			}
 
+			/**
+			 * \brief The character at \em p, or '\0' at the end of \em source.
+			 * \note Nothing after \em end is read, \em source needs no NUL terminator.
+			 */
+			char Peek(const char* p) const { return p < end ? *p : '\0'; }
+
 			/**
 			 * \brief Skip all the white spcaes(' ', \t, \r, \n) from \em position.
+			 * \note Runs of white spaces are skipped 16 or 32 bytes at a time with SIMD.
 			 */
 			void SkipWhitespaces();
 
@@ -595,20 +1454,125 @@ namespace ggicci
 			 * \brief Throw UnexpectedTokenException to indicate an unexpected token in \em source.
 			 */
 			void UnexpectedToken();
+
+			/**
+			 * \brief Throw UnexpectedTokenException for the character at \em p in \em source.
+			 */
+			void UnexpectedAt(const char* p) { pos = p - source; character = Peek(p); UnexpectedToken(); }
 		};
 
+		/**
+		 * \brief The handler building Json objects from the events of a Parser.
+		 * \see jsonla.cc
+		 */
+		class Builder;
+
+		/**
+		 * \brief The thread pool of ParseLines().
+		 * \see jsonla.cc
+		 */
+		class LinePool;
+
+		/**
+		 * \brief The patch generator of Diff().
+		 * \see jsonla.cc
+		 */
+		class Differ;
+
+		/**
+		 * \brief The patch applier of ApplyPatch().
+		 * \see jsonla.cc
+		 */
+		class Patcher;
+
+		/**
+		 * \brief The encoder of ToMsgPack() and ToCbor().
+		 * \see jsonla.cc
+		 */
+		class BinaryWriter;
+
+		/**
+		 * \brief The decoder of FromMsgPack() and FromCbor().
+		 * \see jsonla.cc
+		 */
+		class BinaryReader;
+
 		/**
 		 * \brief Exception indicates syntax error of \em source.
 		 */
 		struct UnexpectedTokenException : std::exception
 		{
 		public:
-			UnexpectedTokenException(char ch, int pos);
+			UnexpectedTokenException(char ch, ptrdiff_t pos);
+
+			/**
+			 * \brief \em end_of_input tells the end from a '\0' in the source, the other
+			 * constructor takes a '\0' \em ch for the end.
+			 */
+			UnexpectedTokenException(char ch, ptrdiff_t pos, bool end_of_input);
+
+			/**
+			 * \brief \em error on line \em line (counting from 0) of newline-delimited json.
+			 * \see ParseLines()
+			 */
+			UnexpectedTokenException(const UnexpectedTokenException& error, size_t line);
 			virtual ~UnexpectedTokenException() throw();
 			const char* what() const throw();
 		private:
 			char 		ch_; 	///< which character cause syntax error
-			int  		pos_;	///< where this character locates
+			ptrdiff_t	pos_;	///< where this character locates
+			std::string msg_;	///< error message
+		};
+
+		/**
+		 * \brief Exception indicates a file can not be read.
+		 */
+		struct FileException : std::exception
+		{
+		public:
+			FileException(const char* path, int error);
+			virtual ~FileException() throw();
+			const char* what() const throw();
+		private:
+			std::string msg_;	///< error message
+		};
+
+		/**
+		 * \brief Exception indicates a JSON Patch can not be applied.
+		 */
+		struct PatchException : std::exception
+		{
+		public:
+			PatchException(const char* reason, const std::string& pointer);
+			virtual ~PatchException() throw();
+			const char* what() const throw();
+		private:
+			std::string msg_;	///< error message
+		};
+
+		/**
+		 * \brief Exception indicates a Json object can not be encoded in MessagePack.
+		 */
+		struct EncodeException : std::exception
+		{
+		public:
+			explicit EncodeException(const char* reason);
+			virtual ~EncodeException() throw();
+			const char* what() const throw();
+		private:
+			std::string msg_;	///< error message
+		};
+
+		/**
+		 * \brief Exception indicates MessagePack or CBOR data can not be decoded.
+		 */
+		struct DecodeException : std::exception
+		{
+		public:
+			DecodeException(const char* reason, size_t pos);
+			virtual ~DecodeException() throw();
+			const char* what() const throw();
+		private:
 			std::string msg_;	///< error message
 		};
 
@@ -634,34 +1598,67 @@ namespace ggicci
 		};
 
 		/**
-		 * \brief Delete Json object in an array (vector)
+		 * \brief Exchange the data of two Json objects.
+		 */
+		void Swap(Json& rhs) noexcept;
+
+		/**
+		 * \brief An empty array Json object on the heap.
 		 */
-		static void DestroyArrayData(ArrayData& arr);
+		static Json MakeArray();
 
 		/**
-		 * \brief Delete Json object in an object (map)
+		 * \brief An empty object Json object on the heap.
 		 */
-		static void DestroyObjectData(ObjectData& obj);
+		static Json MakeObject();
 
 		/**
-		 * \brief Construct from a Json object pointed by /em rhs
+		 * \brief Whether \em a and \em b are the same value, see operator==.
 		 */
-		explicit Json(Json* rhs);
+		static bool Equal(const Json& a, const Json& b);
 
 		/**
-		 * \brief Consturct from a map
+		 * \brief Remove the null members of the objects, recursively, the elements of arrays are kept.
 		 */
-		explicit Json(ObjectData* obj);
+		void DropNulls();
 
 		/**
-		 * \brief Construct from a vector
+		 * \brief Copy work: share the heap containers and strings of \em rhs, copy the others.
 		 */
-		explicit Json(ArrayData* arr);
+		void DoCopy(const Json& rhs);
 
 		/**
-		 * \brief Deep copy work.
+		 * \brief Ready \em value to be moved into this container, which may be shared.
+		 *
+		 * The copies sharing a container must not depend on the input nor on a
+		 * Document: \em value is copied unless Settled().
+		 * \note Nothing is done for the containers of a Document, they are never shared.
+		 */
+		void Adopt(Json& value);
+
+		/**
+		 * \brief Whether a copy of \em json may share it rather than copy it.
+		 *
+		 * String views, the values of a Document and the borrowed containers are
+		 * not. An exposed container is walked: unless a view was written into it
+		 * through a reference, it is shared, and it is no longer exposed since the
+		 * references into it are invalidated by the copy.
+		 */
+		static bool Settled(const Json& json);
+
+		/**
+		 * \brief Copy a container shared with other Json objects, before modifying it.
+		 * \note The copy is one level deep, its elements or members share their values.
+		 */
+		void Unshare();
+
+		/**
+		 * \brief Unshare() a container and mark it exposed, before handing out references into it.
+		 *
+		 * Its hash is not kept while it is, the values may change behind it, and
+		 * the next copy checks what was written into it, see Settled().
 		 */
-		void DoDeepCopy(const Json& rhs);
+		void Expose();
 
 		/**
 		 * \brief Release memory of a Json object.
@@ -669,38 +1666,935 @@ namespace ggicci
 		void Release();
 
 		/**
-		 * \brief Convert data to specified type. Return the reference.
+		 * \brief Make this (null) Json object a string holding a copy of \em str.
+		 * \note Long strings are allocated from \em arena, or the heap if it is null.
 		 */
-		template <typename ToType>
-		ToType& Data()
-		{
-			return const_cast<ToType&>(static_cast<const Json&>(*this).Data<ToType>());
-		}
+		void SetString(const char* str, size_t size, Arena* arena = 0);
+
+		/**
+		 * \brief Throw BadConversionException unless this Json object is a \em kind.
+		 */
+		void Expect(Kind kind) const { if (kind_ != kind) { throw BadConversionException(); } }
+
+		/**
+		 * \brief The container, unshared to be modified, or throw BadConversionException.
+		 */
+		ArrayData& Array() { Expect(kArray); Unshare(); return *value_.array; }
+		const ArrayData& Array() const { Expect(kArray); return *value_.array; }
+		ObjectData& Object() { Expect(kObject); Unshare(); return *value_.object; }
+		const ObjectData& Object() const { Expect(kObject); return *value_.object; }
+
+		/**
+		 * \brief Make this (null) Json object a string referencing \em str without copying.
+		 * \note Short strings are still copied inline.
+		 */
+		void SetView(const char* str, size_t size);
+
+		/**
+		 * \brief Make this (null) Json object a string referencing the interned \em str.
+		 * \note Short strings are still copied inline.
+		 */
+		void SetInterned(const char* str, size_t size);
+
+		/**
+		 * \brief The null Json object the const lookups give for a missing key.
+		 */
+		static const Json& Missing();
+
+		/**
+		 * \brief The interned copy of [str, str + size), \em hash is HashKey() of it.
+		 *
+		 * Each distinct key is allocated once and lives as long as the process.
+		 */
+		static const char* Intern(const char* str, size_t size, uint32_t hash);
+
+		/**
+		 * \brief A string Json object referencing \em str, to look up keys without copying.
+		 */
+		static Json View(const char* str, size_t size) { Json json; json.SetView(str, size); return json; }
 
 		/**
-		 * \brief Convert data to specified type. Return the reference.
+		 * \brief Characters of a string Json object, not NUL-terminated if a view.
 		 */
-		template <typename ToType>
-		const ToType& Data() const
+		const char* StringData() const { return kInline == storage_ ? value_.chars : value_.text.data; }
+
+		/**
+		 * \brief Number of characters of a string Json object.
+		 */
+		size_t StringSize() const { return kInline == storage_ ? size_ : value_.text.size; }
+
+		/**
+		 * \brief The RefCount before the characters of a kShared string.
+		 */
+		static RefCount& SharedRefs(const char* data)
+		{
+			return *reinterpret_cast<RefCount*>(const_cast<char*>(data) - sizeof(RefCount));
+		}
+
+		Kind kind_;				///< which kind of data this Json object represents
+		unsigned char storage_;	///< how a string is stored (see Storage), or a NumberType
+		unsigned char size_;	///< number of characters of an inline string
+		Value value_;			///< the real data held by the Json object
+	};
+
+/**
+ * \brief The elements of an array, stored by value one after another.
+ * \note Pushing or removing an element may move the others.
+ */
+class Json::ArrayData : public std::vector<Json, Json::ArenaAllocator<Json> >
+{
+public:
+	typedef std::vector<Json, ArenaAllocator<Json> > Elements;
+
+	explicit ArrayData(const allocator_type& alloc = allocator_type()) : Elements(alloc) { }
+
+	RefCount refs;	///< the Json objects sharing it, the heap ones only
+	HashCache hash;	///< see Hash()
+};
+
+inline int Json::Size() const { return IsArray() ? static_cast<int>(value_.array->size()) : 1; }
+inline const Json& Json::operator[] (int index) const { return Array()[index]; }
+inline Json& Json::operator[] (int index)
+{
+	Expect(kArray);
+	Expose();
+	return (*value_.array)[index];
+}
+
+/**
+ * \brief The members of an object, kept in insertion order in one contiguous vector.
+ *
+ * The keys and the values are stored by value next to each other, there is no
+ * node nor Json allocated per member. Small objects are searched linearly, the
+ * sizes of the keys are compared first. Above kIndexThreshold members an
+ * open-addressing hash index of the member positions keeps lookups constant.
+ * \note Inserting or erasing a member may move the others, references to
+ * 		 the values of an object are invalidated by its modification.
+ */
+class Json::ObjectData
+{
+public:
+	/**
+	 * \brief A key (a string Json object) and its value.
+	 */
+	struct Member
+	{
+		Json key;
+		Json value;
+	};
+
+	typedef ArenaAllocator<Member> allocator_type;
+	typedef std::vector<Member, allocator_type> Members;
+	typedef Members::iterator iterator;
+	typedef Members::const_iterator const_iterator;
+
+	explicit ObjectData(const allocator_type& alloc = allocator_type())
+		: members_(alloc), index_(ArenaAllocator<uint32_t>(alloc.arena)) { }
+
+	size_t size() const { return members_.size(); }
+	bool empty() const { return members_.empty(); }
+	iterator begin() { return members_.begin(); }
+	iterator end() { return members_.end(); }
+	const_iterator begin() const { return members_.begin(); }
+	const_iterator end() const { return members_.end(); }
+	allocator_type get_allocator() const { return members_.get_allocator(); }
+
+	void reserve(size_t size) { members_.reserve(size); }
+
+	/**
+	 * \brief Find the member of key [key, key + size).
+	 * @return the member, or null if there is none
+	 */
+	Member* Find(const char* key, size_t size)
+	{
+		return const_cast<Member*>(static_cast<const ObjectData&>(*this).Find(key, size));
+	}
+	const Member* Find(const char* key, size_t size) const;
+
+	/**
+	 * \brief Find the member of \em key, with the hash it carries.
+	 */
+	Member* Find(const Key& key) { return const_cast<Member*>(static_cast<const ObjectData&>(*this).Find(key)); }
+	const Member* Find(const Key& key) const;
+
+	/**
+	 * \brief Append a member with \em key and a null value, unless the key is already there.
+	 * @param inserted set to false when the key was already there
+	 * @return the value of the key
+	 */
+	Json& Insert(Json&& key, bool& inserted);
+
+	/**
+	 * \brief Remove \em member, the members after it keep their order.
+	 */
+	void Erase(Member* member);
+
+	/**
+	 * \brief Insert \em member at \em position, where Erase() took it from.
+	 * \note The key must not be there already.
+	 */
+	void InsertAt(size_t position, Member&& member);
+
+	RefCount refs;	///< the Json objects sharing it, the heap ones only
+	HashCache hash;	///< see Hash()
+
+private:
+	static const size_t kIndexThreshold = 16;	///< members searched linearly at most
+
+	/**
+	 * \brief Find the member of key [key, key + size) whose hash is \em hash.
+	 * \note \em hash is only used by the index, small objects ignore it.
+	 */
+	const Member* Find(const char* key, size_t size, uint32_t hash) const;
+
+	/**
+	 * \brief Whether the key of \em member is [key, key + size), interned keys match by address.
+	 */
+	static bool SameKey(const Member& member, const char* key, size_t size);
+
+	/**
+	 * \brief Rebuild the index with \em slots slots (a power of 2), or drop it for small objects.
+	 */
+	void Reindex(size_t slots);
+
+	/**
+	 * \brief Put the member at \em position into the index.
+	 */
+	void Place(size_t position);
+
+	Members members_;
+	std::vector<uint32_t, ArenaAllocator<uint32_t> > index_;	///< position + 1 per slot, 0 for a free one
+};
+
+/**
+ * \brief A pair of iterators, for range-based for loops.
+ */
+template <typename Iterator>
+class Json::Range
+{
+public:
+	Range(Iterator begin, Iterator end) : begin_(begin), end_(end) { }
+
+	Iterator begin() const { return begin_; }
+	Iterator end() const { return end_; }
+	bool empty() const { return begin_ == end_; }
+
+private:
+	Iterator begin_;
+	Iterator end_;
+};
+
+/**
+ * \brief A member of an object seen through Items(): a view of its key and its value.
+ */
+template <typename Value>
+struct Json::BasicItem
+{
+	const char* key;	///< the characters of the key, not NUL-terminated if parsed as a view
+	size_t key_size;	///< number of characters of the key
+	Value& value;		///< the value of the member
+};
+
+/**
+ * \brief Iterator over the members of an object, giving BasicItem values.
+ *
+ * It walks the members where they are stored, an Item is made of pointers
+ * into the member it is given for.
+ */
+template <typename Value>
+class Json::ItemIterator
+{
+public:
+	typedef std::input_iterator_tag iterator_category;
+	typedef BasicItem<Value> value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef value_type reference;	///< made on the fly, like the elements of a std::vector<bool>
+
+	typedef typename std::conditional<std::is_const<Value>::value,
+		const ObjectData::Member, ObjectData::Member>::type Member;
+
+	explicit ItemIterator(Member* member = 0) : member_(member) { }
+
+	value_type operator * () const
+	{
+		value_type item = { member_->key.StringData(), member_->key.StringSize(), member_->value };
+		return item;
+	}
+	ItemIterator& operator ++ () { ++member_; return *this; }
+	ItemIterator operator ++ (int) { ItemIterator it(*this); ++member_; return it; }
+	bool operator == (const ItemIterator& rhs) const { return member_ == rhs.member_; }
+	bool operator != (const ItemIterator& rhs) const { return member_ != rhs.member_; }
+
+private:
+	Member* member_;
+};
+
+/**
+ * \brief An interned object key with a precomputed hash, for repeated lookups.
+ *
+ * Constructing a Key looks its characters up in a process-wide table, which
+ * stores each distinct key once and never frees it. A Key is then only a
+ * pointer, a size and a hash: looking it up in an object hashes nothing and
+ * allocates nothing, and the members which reference the same interned
+ * characters (added through a Key or parsed with kParseInternKeys) are
+ * matched by address. The table is shared by all the threads.
+ * \note Keys are meant to be the constants of a program, interning unbounded
+ * 		 input (like user ids) would grow the table forever.
+ *
+ * \code{.cpp}
+ * static const Json::Key kUserId("user_id");
+ * for (int i = 0; i < users.Size(); ++i)
+ * {
+ * 	ids.push_back(users[i][kUserId].AsInt());
+ * }
+ * \endcode
+ */
+class Json::Key
+{
+public:
+	explicit Key(const char* str);
+	explicit Key(const std::string& str);
+	Key(const char* str, size_t size);
+
+	const char* Data() const { return data_; }		///< the interned characters, NUL-terminated
+	size_t Size() const { return size_; }			///< number of characters
+	uint32_t Hash() const { return hash_; }			///< hash of the characters, as objects index them
+	std::string ToString() const { return std::string(data_, size_); }
+
+private:
+	const char* data_;
+	size_t size_;
+	uint32_t hash_;
+};
+
+/**
+ * \brief A JSON Pointer (RFC 6901) parsed once, to find a nested value in one call.
+ *
+ * A pointer is a list of reference tokens, each one after a '/': "/a/b/3/c"
+ * refers to json["a"]["b"][3]["c"] and "" to the whole value, in a token
+ * "~1" stands for '/' and "~0" for '~'. The tokens are unescaped and interned
+ * like Key once, when the Pointer is constructed, the ones which are array
+ * indices are parsed too. "-" (the end of an array) never refers to a value.
+ * \note Pointers are meant to be the constants of a program, like Key.
+ *
+ * \code{.cpp}
+ * static const Json::Pointer kHost("/request/headers/host");
+ * const Json* host = json.Find(kHost);
+ * Json::Pointer("a/b"); // throws, a pointer starts with '/'
+ * \endcode
+ */
+class Json::Pointer
+{
+public:
+	/**
+	 * \brief Parse \em pointer, it throws an exception if it is not a JSON Pointer.
+	 */
+	explicit Pointer(const char* pointer);
+	explicit Pointer(const std::string& pointer);
+
+	size_t Depth() const { return segments_.size(); }		///< number of reference tokens
+	const std::string& ToString() const { return text_; }	///< the pointer, escaped
+
+private:
+	friend class Json;
+	friend class Json::Pointers;
+
+	/**
+	 * \brief A reference token: a member key, or an element index.
+	 */
+	struct Segment
+	{
+		Segment(const Key& k, size_t i) : key(k), index(i) { }
+		Key key;		///< the unescaped token, interned
+		size_t index;	///< the token as an array index, kNoIndex if it is not one
+	};
+
+	static const size_t kNoIndex = ~static_cast<size_t>(0);
+
+	/**
+	 * \brief The value \em segment refers to in \em json, or null.
+	 */
+	static const Json* Step(const Json& json, const Segment& segment);
+
+	void Compile();
+
+	std::string text_;
+	std::vector<Segment> segments_;
+};
+
+/**
+ * \brief Many Pointer objects found together in one walk of a Json object.
+ *
+ * The pointers are merged into a tree of their segments (a trie), so a
+ * prefix shared by several pointers is looked up once per Json::Find() call.
+ * Build it once with the fixed paths of a program and find them in every
+ * document, like a router reading the same fields of each request.
+ *
+ * \code{.cpp}
+ * Json::Pointers fields;
+ * size_t host = fields.Add(Json::Pointer("/request/headers/host"));
+ * size_t agent = fields.Add(Json::Pointer("/request/headers/user-agent"));
+ * vector<const Json*> values;
+ * request.Find(fields, values);
+ * if (values[host]) { Route(values[host]->AsString()); }
+ * \endcode
+ */
+class Json::Pointers
+{
+public:
+	Pointers();
+
+	/**
+	 * \brief Add \em pointer to the set.
+	 * @return the position of its value in the results of Json::Find(), the same for equal pointers
+	 */
+	size_t Add(const Pointer& pointer);
+
+	size_t Size() const { return count_; }	///< number of distinct pointers
+
+private:
+	friend class Json;
+
+	/**
+	 * \brief A segment in the trie, its children are chained through \em sibling.
+	 */
+	struct Node
+	{
+		explicit Node(const Pointer::Segment& s) : segment(s), child(0), sibling(0), result(0) { }
+		Pointer::Segment segment;
+		uint32_t child;		///< the first child, 0 for none (node 0 is the root)
+		uint32_t sibling;	///< the next child of the same parent, 0 for none
+		uint32_t result;	///< position of the result + 1 if a pointer ends here, or 0
+	};
+
+	/**
+	 * \brief Set the results of the pointers below \em node, which refers to \em json.
+	 */
+	void Visit(uint32_t node, const Json& json, const Json** results) const;
+
+	std::vector<Node> nodes_;	///< nodes_[0] is the root, the empty pointer
+	size_t count_;				///< number of results
+};
+
+/**
+ * \brief A parsed json document whose values live in one arena.
+ *
+ * Json::Parse() allocates every value, string and container on its own.
+ * A Document allocates all of them from a bump-pointer arena instead, and
+ * releasing the document frees a few big blocks rather than walking the tree.
+ * Parsing again into the same Document reuses the memory of the last parse.
+ *
+ * The values of a Document are read-only. Copy a value out (into a plain
+ * Json) when you need to modify it or keep it after the Document is gone.
+ *
+ * \code{.cpp}
+ * Json::Document doc;
+ * const Json& json = doc.Parse("{\"id\": 1234, \"tags\": [\"dog\", \"anime\"]}");
+ * json["id"].AsInt(); // 1234
+ * Json tags = json["tags"]; // a deep copy on the heap
+ * \endcode
+ */
+class Json::Document
+{
+public:
+	/**
+	 * \brief Construct an empty document, Root() is null.
+	 */
+	Document();
+
+	/**
+	 * \brief Free all the values of the document at once.
+	 */
+	~Document();
+
+	/**
+	 * \brief Parse a json structural string into this document.
+	 *
+	 * The values of the previous parse are released (references to them are
+	 * dangling afterwards). The root is null if an exception is thrown.
+	 * @param  json_string json structural string
+	 * @param  flags       ParseFlag values combined with '|', see Json::Parse()
+	 * @return             the root value of the document
+	 */
+	const Json& Parse(const char* json_string, ParseFlag flags = kParseDefault);
+
+	/**
+	 * \brief Parse the \em size characters at \em data into this document.
+	 * \see Json::Parse(const char*, size_t, ParseFlag)
+	 */
+	const Json& Parse(const char* data, size_t size, ParseFlag flags = kParseDefault);
+
+	/**
+	 * \brief Get the root value of the document.
+	 */
+	const Json& Root() const { return root_ ? *root_ : null_; }
+
+	/**
+	 * \brief Release all the values, Root() becomes null.
+	 */
+	void Clear();
+
+private:
+	Document(const Document&);
+	Document& operator = (const Document&);
+
+	Arena arena_;		///< where all the values are allocated
+	const Json* root_;	///< the root value, allocated from \em arena_
+	Json null_;			///< returned by Root() when there is no root
+};
+
+/**
+ * \brief A parser fed with chunks of a json stream, it keeps its state in between.
+ *
+ * Json::Parse() needs the whole document in one NUL-terminated string. A
+ * PushParser takes the bytes as they come, in chunks of any size, and picks up
+ * where it stopped: in the middle of a string, an escape sequence, a number
+ * or a literal. The stream is a sequence of json values (separated by white
+ * spaces or not, e.g. one per line), every value is ready as soon as it closes.
+ * A number at the end of the stream needs Finish() (or a following white
+ * space) to close.
+ *
+ * Syntax errors throw like Json::Parse(), the positions counting from the
+ * start of the stream. Reset() before feeding again after an error.
+ *
+ * \code{.cpp}
+ * Json::PushParser parser;
+ * while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+ * {
+ * 	parser.Feed(buffer, n);
+ * 	Json json;
+ * 	while (parser.Next(json)) { Handle(json); }
+ * }
+ * parser.Finish();
+ * \endcode
+ */
+class Json::PushParser
+{
+public:
+	PushParser();
+	~PushParser();
+
+	/**
+	 * \brief Parse the next \em size bytes of the stream.
+	 * \note The bytes are not referenced after the call.
+	 */
+	void Feed(const char* data, size_t size);
+
+	/**
+	 * \brief Tell the stream is over, close the last value.
+	 * \note Throws if the stream ends in the middle of a value.
+	 */
+	void Finish();
+
+	/**
+	 * \brief Take the oldest value which is ready.
+	 * @return false if no value is ready, \em json is left unchanged then
+	 */
+	bool Next(Json& json);
+
+	/**
+	 * \brief Forget everything, ready for a new stream.
+	 */
+	void Reset();
+
+private:
+	/**
+	 * \brief Where the parser is between two bytes.
+	 */
+	enum State
+	{
+		kValue,			///< before a value, or between values at the top level
+		kFirstValue,	///< after '[', before a value or ']'
+		kKey,			///< after ',' in an object, before a key
+		kFirstKey,		///< after '{', before a key or '}'
+		kColon,			///< after a key
+		kComma,			///< after a value in a container, before ',' or the closer
+		kString,		///< in a string or a key
+		kEscape,		///< after a backslash in a string or a key
+		kNumber,		///< in a number
+		kLiteral		///< in true, false or null
+	};
+
+	PushParser(const PushParser&);
+	PushParser& operator = (const PushParser&);
+
+	/**
+	 * \brief Handle the operator, or the first character of a value, at \em p.
+	 */
+	void Structural(const char* p);
+
+	/**
+	 * \brief Start a string, number or literal at \em p.
+	 */
+	void BeginToken(State state, const char* p);
+
+	/**
+	 * \brief End the string in \em token_, or in [\em begin, \em end) if not carried over.
+	 */
+	void EndString(const char* begin, const char* end);
+
+	/**
+	 * \brief End the number in \em token_, followed by \em next at \em next_position.
+	 */
+	void EndNumber(char next, size_t next_position);
+
+	/**
+	 * \brief End the literal in \em token_, followed by \em next at \em next_position.
+	 */
+	void EndLiteral(char next, size_t next_position);
+
+	/**
+	 * \brief A value is complete, close it (the top level values are ready).
+	 */
+	void EndValue();
+
+	/**
+	 * \brief Position of \em p (in the current chunk) in the stream.
+	 */
+	size_t Position(const char* p) const { return offset_ + (p - chunk_); }
+
+	/**
+	 * \brief Throw UnexpectedTokenException for \em ch at \em position in the stream.
+	 */
+	void Unexpected(char ch, size_t position);
+
+	Builder* builder_;			///< builds the values from the events
+	std::vector<char> closers_;	///< the closing characters of the open containers
+	std::deque<Json> values_;	///< the top level values ready
+	std::string token_;			///< the characters of a token carried over from the last chunks
+	State state_;				///< where the parser is
+	bool key_;					///< the string is a key
+	bool escaped_;				///< the string has escape sequences
+	size_t offset_;				///< position of the current chunk in the stream
+	size_t token_offset_;		///< position of the current token in the stream
+	const char* chunk_;			///< the current chunk
+};
+
+/**
+ * \brief A serializer writing Json objects into a string, a file or a buffer.
+ *
+ * The text goes straight into one buffer in a single pass over the values:
+ * the end of a std::string growing as needed, a fixed buffer of the caller,
+ * or a staging buffer written to a FILE* or a file descriptor when full.
+ * There are no intermediate strings, a Writer into a reused std::string does
+ * not allocate at all once the string is big enough.
+ *
+ * A fixed buffer is never overrun: what does not fit is counted, not written
+ * (like snprintf), see Size() and Truncated(). The text is not NUL-terminated.
+ *
+ * \code{.cpp}
+ * Json::Writer(stdout).Write(json).Flush(); // throws FileException on a write error
+ * string out;
+ * Json::Writer writer(out);
+ * writer.Write(json).Flush(); // out holds the text of json
+ * \endcode
+ */
+class Json::Writer
+{
+public:
+	/**
+	 * \brief Append to \em out.
+	 */
+	explicit Writer(std::string& out);
+
+	/**
+	 * \brief Write to \em file, through a staging buffer.
+	 */
+	explicit Writer(FILE* file);
+
+	/**
+	 * \brief Write to the file descriptor \em fd, through a staging buffer.
+	 */
+	explicit Writer(int fd);
+
+	/**
+	 * \brief Write into the \em capacity bytes at \em buffer.
+	 */
+	Writer(char* buffer, size_t capacity);
+
+	/**
+	 * \brief Flush what is left, the errors are dropped silently.
+	 * \note A destructor can not throw: call Flush() before the Writer goes away
+	 * 		 to get the write errors of a file or a descriptor.
+	 */
+	~Writer();
+
+	/**
+	 * \brief Write the text of \em json.
+	 * \note Like Flush(), it throws an exception if the staging buffer is full and
+	 * 		 can not be written to the file or the descriptor.
+	 * @return this Writer, to chain the calls
+	 */
+	Writer& Write(const Json& json);
+
+	/**
+	 * \brief Pass the text written so far to the string, file or descriptor.
+	 * \note It throws an exception if a file or a descriptor can not be written.
+	 */
+	void Flush();
+
+	/**
+	 * \brief Number of characters written, including what did not fit in a fixed buffer.
+	 */
+	size_t Size() const { return written_ + (cursor_ - begin_); }
+
+	/**
+	 * \brief Whether the text did not fit in the fixed buffer.
+	 */
+	bool Truncated() const { return kToBuffer == sink_ && Size() > capacity_; }
+
+private:
+	/**
+	 * \brief Where the text goes.
+	 */
+	enum Sink
+	{
+		kToString,		///< the end of \em string_, the window is in it
+		kToFile,			///< \em file_, the window is \em staging_
+		kToDescriptor,	///< \em fd_, the window is \em staging_
+		kToBuffer			///< the caller buffer, then \em staging_ to count what does not fit
+	};
+
+	static const size_t kStagingSize = 4096;
+
+	Writer(const Writer&);
+	Writer& operator = (const Writer&);
+
+	void Put(char ch) { if (cursor_ == limit_) { Drain(1); } *cursor_++ = ch; }
+	void Put(const char* str, size_t size);
+	void PutQuoted(const char* str, size_t size);
+	void PutNumber(double number);
+	void PutInteger(uint64_t magnitude, bool negative);
+	void PutValue(const Json& json);
+
+	/**
+	 * \brief Empty the window into the sink, or grow it, to make room for more characters.
+	 * \note The string grows by at least \em room characters, other sinks get a new window.
+	 */
+	void Drain(size_t room);
+
+	Sink sink_;
+	std::string* string_;			///< kToString
+	size_t origin_;					///< kToString, size of \em string_ before the Writer
+	FILE* file_;					///< kToFile
+	int fd_;						///< kToDescriptor
+	size_t capacity_;				///< kToBuffer, size of the caller buffer
+	char* begin_;					///< the window the characters are written in
+	char* cursor_;					///< the next character of the window
+	char* limit_;					///< the end of the window
+	size_t written_;				///< number of characters before the window
+	char staging_[kStagingSize];	///< the window for files and descriptors
+};
+
+/**
+ * \brief A handler of Json::ParseEvents() ignoring every event.
+ *
+ * A handler is any class with these member functions. Deriving from BaseHandler
+ * lets it define only the events it cares for. Strings and keys are not
+ * NUL-terminated and \em str is only valid during the call. Numbers come as
+ * doubles, except for the integers which fit in 64 bits when the handler also
+ * defines Int64(int64_t) (and UInt64(uint64_t) for those above INT64_MAX): these
+ * come exact. BaseHandler does not define them, so a handler which only cares
+ * for doubles gets every number in Number(). Return false from any event to
+ * stop the parsing.
+ */
+struct Json::BaseHandler
+{
+	bool Null() { return true; }
+	bool Bool(bool) { return true; }
+	bool Number(double) { return true; }
+	bool String(const char*, size_t) { return true; }
+	bool Key(const char*, size_t) { return true; }
+	bool StartObject() { return true; }
+	bool EndObject() { return true; }
+	bool StartArray() { return true; }
+	bool EndArray() { return true; }
+};
+
+template <typename Handler>
+bool Json::ParseEvents(const char* json_string, Handler& handler, ParseFlag flags)
+{
+	Parser parser(json_string, flags);
+	return parser.ParseDocument(handler);
+}
+
+/* Json::Parser, the grammar shared by all the handlers */
+template <typename Handler>
+bool Json::Parser::ParseDocument(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseDocument(Handler& handler)");
+	// the structural positions are 32-bit, larger inputs go to the recursive descent
+	if ((flags & kParseStructuralIndex) && end - source < 0xFFFFFFFF)
+	{
+		BuildStructuralIndex();
+		return ParseIndexed(handler);
+	}
+	if (!ParseValue(handler)) { return false; }
+	// nothing but white spaces after the value
+	NextCharacter();
+	if (!EOL()) { UnexpectedToken(); }
+	return true;
+} // end fn:ParseDocument
+
+template <typename Handler>
+bool Json::Parser::ParseValue(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseValue(Handler& handler)");
+	SkipWhitespaces();
+	bool go_on;
+	switch (KindDetect())
+	{
+		case kObject: { go_on = ParseObject(handler); break; }
+		case kArray: { go_on = ParseArray(handler); break; }
+		default: { go_on = ParseScalar(handler); break; }
+	}
+	SkipWhitespaces();
+	return go_on;
+} // end fn:ParseValue
+
+template <typename Handler>
+bool Json::Parser::ParseScalar(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseScalar(Handler& handler)");
+	switch (Peek(source + pos + 1))
+	{
+		case '\"': { ScanString(); return handler.String(text, text_size); }
+		case 't': { ConsumeSpecific("true"); return handler.Bool(true); }
+		case 'f': { ConsumeSpecific("false"); return handler.Bool(false); }
+		case 'n': { ConsumeSpecific("null"); return handler.Null(); }
+		default: { Number number; ScanNumber(number); return EmitNumber(handler, number); } // or a syntax error
+	}
+} // end fn:ParseScalar
+
+template <typename Handler>
+bool Json::Parser::EmitNumber(Handler& handler, const Number& number)
+{
+	switch (number.type)
+	{
+		case kInt64: { return EmitInteger(handler, number.integer, 0); }
+		case kUInt64: { return EmitInteger(handler, number.unsigned_integer, 0); }
+		default: { return handler.Number(number.value); }
+	}
+} // end fn:EmitNumber
+
+template <typename Handler>
+bool Json::Parser::ParseObject(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseObject(Handler& handler)");
+	if ('{' != NextCharacter()) { UnexpectedToken(); }
+	if (!handler.StartObject()) { return false; }
+	SkipWhitespaces();
+	if ('}' != NextCharacter()) // at least need one pair
+	{
+		Retract();
+		do
+		{
+			ScanString();
+			if (!handler.Key(text, text_size)) { return false; }
+			SkipWhitespaces();
+			ConsumeSpecific(":");
+			if (!ParseValue(handler)) { return false; }
+		} while (',' == NextCharacter());
+		if ('}' != character) { UnexpectedToken(); }
+	}
+	return handler.EndObject();
+} // end fn:ParseObject
+
+template <typename Handler>
+bool Json::Parser::ParseArray(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseArray(Handler& handler)");
+	if ('[' != NextCharacter()) { UnexpectedToken(); }
+	if (!handler.StartArray()) { return false; }
+	SkipWhitespaces();
+	if (']' != NextCharacter()) // at least one value
+	{
+		Retract();
+		do
+		{
+			if (!ParseValue(handler)) { return false; }
+		} while (',' == NextCharacter());
+		if (']' != character) { UnexpectedToken(); }
+	}
+	return handler.EndArray();
+} // end fn:ParseArray
+
+template <typename Handler>
+bool Json::Parser::ParseIndexed(Handler& handler)
+{
+	TRACK("bool Json::Parser::ParseIndexed(Handler& handler)");
+	std::vector<char> closers;	// the closing characters of the open containers
+	const uint32_t* next = &structurals[0];
+	while (true)
+	{
+		// a value starts at *next
+		char ch = Peek(source + *next);
+		if ('{' == ch || '[' == ch)
 		{
-			bool okay;
-			switch(kind_)
+			char closer = ('{' == ch) ? '}' : ']';
+			if (!('{' == ch ? handler.StartObject() : handler.StartArray())) { return false; }
+			if (closer != Peek(source + *++next))
 			{
-			case kNumber: okay = (typeid(double) == typeid(ToType)); break;
-			case kString: okay = (typeid(std::string) == typeid(ToType)); break;
-			case kBool: okay = (typeid(bool) == typeid(ToType)); break;
-			case kArray: okay = (typeid(ArrayData) == typeid(ToType)); break;
-			case kObject: okay = (typeid(ObjectData) == typeid(ToType)); break;
-			default: okay = false;
+				closers.push_back(closer);
+				if ('}' == closer && !ParseKeyAt(next, handler)) { return false; }
+				continue;
 			}
-			if (!okay) throw BadConversionException();
-			return *static_cast<ToType*>(data_);
+			// empty container, it is a complete value
+			++next;
+			if (!('}' == closer ? handler.EndObject() : handler.EndArray())) { return false; }
 		}
-		
-		Kind kind_;		///< which kind of data this Json object represents
-		void *data_;	///< the real data held by the Json object
-	};
+		else
+		{
+			pos = static_cast<ptrdiff_t>(*next++) - 1;
+			if (!ParseScalar(handler)) { return false; }
+			ExpectSeparator();
+		}
+
+		// a value is complete, close the containers ending here
+		while (true)
+		{
+			if (closers.empty())
+			{
+				if (*next != static_cast<uint32_t>(end - source)) { UnexpectedAt(source + *next); }
+				return true;
+			}
+			ch = Peek(source + *next++);
+			if (',' == ch)
+			{
+				if ('}' == closers.back() && !ParseKeyAt(next, handler)) { return false; }
+				break;
+			}
+			if (closers.back() != ch) { UnexpectedAt(source + *(next - 1)); }
+			closers.pop_back();
+			if (!('}' == ch ? handler.EndObject() : handler.EndArray())) { return false; }
+		}
+	}
+} // end fn:ParseIndexed
+
+template <typename Handler>
+bool Json::Parser::ParseKeyAt(const uint32_t*& next, Handler& handler)
+{
+	if ('\"' != Peek(source + *next)) { UnexpectedAt(source + *next); }
+	pos = static_cast<ptrdiff_t>(*next) - 1;
+	ScanString();
+	if (':' != Peek(source + *++next)) { UnexpectedAt(source + *next); }
+	++next;
+	return handler.Key(text, text_size);
+} // end fn:ParseKeyAt
+
+}
 
+namespace std
+{
+	/**
+	 * \brief Json objects as keys of unordered containers, hashed by Json::Hash().
+	 */
+	template <>
+	struct hash<ggicci::Json>
+	{
+		size_t operator()(const ggicci::Json& json) const { return static_cast<size_t>(json.Hash()); }
+	};
 }
 
 #endif // GGICCI_JSONLA_H_
@@ -1,6 +1,11 @@
 #include "../jsonla.h"
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
 #include "gtest/gtest.h"
 
 using namespace std;
@@ -55,3 +60,1181 @@ TEST_F(JsonTest, GetArraySize) {
   Json arr = Json::Parse("[1,2,3,4]");
   EXPECT_EQ(arr.Size(), 4);
 }
+
+TEST_F(JsonTest, DocumentParse) {
+  Json::Document doc;
+  const Json& json = doc.Parse(
+      "{\"id\": 1234, \"name\": \"a string longer than the small buffer\","
+      " \"tags\": [\"dog\", true, null, {\"nest\": [1.5]}]}");
+  EXPECT_TRUE(json.IsObject());
+  EXPECT_EQ(json["id"].AsInt(), 1234);
+  EXPECT_EQ(json["name"].AsString(), "a string longer than the small buffer");
+  EXPECT_EQ(json["tags"].Size(), 4);
+  EXPECT_TRUE(json["tags"][1].AsBool());
+  EXPECT_TRUE(json["tags"][2].IsNull());
+  EXPECT_EQ(json["tags"][3]["nest"][0].AsDouble(), 1.5);
+  EXPECT_EQ(&doc.Root(), &json);
+}
+
+TEST_F(JsonTest, DocumentReuseAndCopyOut) {
+  Json copy;
+  {
+    Json::Document doc;
+    string big = "[";
+    for (int i = 0; i < 10000; ++i) {
+      big += (i ? ", " : "");
+      big += "{\"key number one\": \"value number one\", \"n\": 7}";
+    }
+    big += "]";
+    EXPECT_EQ(doc.Parse(big.c_str()).Size(), 10000);
+    copy = doc.Parse("{\"kept\": [\"after the document is gone\"]}")["kept"];
+  }
+  EXPECT_EQ(copy[0].AsString(), "after the document is gone");
+}
+
+TEST_F(JsonTest, DocumentParseError) {
+  Json::Document doc;
+  doc.Parse("[1, 2]");
+  EXPECT_THROW(doc.Parse("[1, 2, ]"), exception);
+  EXPECT_TRUE(doc.Root().IsNull());
+  doc.Clear();
+  EXPECT_TRUE(doc.Root().IsNull());
+}
+
+TEST_F(JsonTest, ScalarValues) {
+  Json json(3);
+  EXPECT_EQ(json.AsInt(), 3);
+  json = 4.5;
+  EXPECT_EQ(json.AsDouble(), 4.5);
+  json = true;
+  EXPECT_TRUE(json.AsBool());
+  EXPECT_THROW(json.AsDouble(), exception);
+  json = Json();
+  EXPECT_TRUE(json.IsNull());
+  EXPECT_THROW(json.AsBool(), exception);
+}
+
+TEST_F(JsonTest, ShortAndLongStrings) {
+  string inline_max(15, 'a');
+  string allocated(16, 'b');
+  Json arr = Json::Parse(("[\"" + inline_max + "\", \"" + allocated + "\"]").c_str());
+  EXPECT_EQ(arr[0].AsString(), inline_max);
+  EXPECT_EQ(arr[1].AsString(), allocated);
+  Json copy = arr;
+  arr[0] = allocated;
+  arr[1] = "short";
+  EXPECT_EQ(copy[0].AsString(), inline_max);
+  EXPECT_EQ(copy[1].AsString(), allocated);
+  EXPECT_EQ(arr.ToString(), "[ \"" + allocated + "\", \"short\" ]");
+  EXPECT_THROW(arr[1].AsInt(), exception);
+}
+
+TEST_F(JsonTest, MoveSemantics) {
+  Json source = Json::Parse("{\"long key of the object\": [1, 2, \"a string longer than 15\"]}");
+  Json moved(std::move(source));
+  EXPECT_TRUE(source.IsNull());
+  EXPECT_EQ(moved["long key of the object"].Size(), 3);
+
+  Json arr = Json::Parse("[]");
+  arr.Push(Json::Parse("{\"id\": 1}")).Push(std::move(moved));
+  EXPECT_TRUE(moved.IsNull());
+  EXPECT_EQ(arr.Size(), 2);
+  EXPECT_EQ(arr[1]["long key of the object"][2].AsString(), "a string longer than 15");
+
+  Json obj = Json::Parse("{}");
+  Json value("moved into the object, no copy");
+  obj.AddProperty("a", std::move(value));
+  obj["b"] = Json::Parse("[true]");
+  EXPECT_TRUE(value.IsNull());
+  EXPECT_EQ(obj["a"].AsString(), "moved into the object, no copy");
+  EXPECT_TRUE(obj["b"][0].AsBool());
+}
+
+TEST_F(JsonTest, AssignFromOwnChild) {
+  Json json = Json::Parse("[[1, \"a string longer than 15\"], 2]");
+  json = json[0];
+  EXPECT_EQ(json.ToString(), "[ 1, \"a string longer than 15\" ]");
+  json = std::move(json[1]);
+  EXPECT_EQ(json.AsString(), "a string longer than 15");
+  Json scalar(7);
+  scalar.Push(std::move(scalar));
+  EXPECT_EQ(scalar.Size(), 2);
+}
+
+TEST_F(JsonTest, StringEscapes) {
+  Json json = Json::Parse("[\"\\\" \\\\ \\/ \\b \\f \\n \\r \\t\", \"\\u00e9\\u4e2d\\ud83d\\ude00\", \"\\ud800x\"]");
+  EXPECT_EQ(json[0].AsString(), "\" \\ / \b \f \n \r \t");
+  EXPECT_EQ(json[1].AsString(), "\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80");
+  EXPECT_EQ(json[2].AsString(), "\xed\xa0\x80x");
+  EXPECT_EQ(json[0].ToString(), "\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
+  EXPECT_EQ(Json(string("a\0b", 3)).ToString(), "\"a\\u0000b\"");
+  Json round = Json::Parse(json.ToString().c_str());
+  EXPECT_EQ(round.ToString(), json.ToString());
+}
+
+TEST_F(JsonTest, StringViews) {
+  char source[] = "{\"a key longer than fifteen\": \"a value longer than fifteen\","
+                  " \"escaped value\": \"with \\\"quotes\\\" inside of it\", \"short\": \"abc\"}";
+  Json json = Json::Parse(source, Json::kParseStringViews);
+  Json copy = json;
+  EXPECT_EQ(json["a key longer than fifteen"].AsString(), "a value longer than fifteen");
+  EXPECT_EQ(json["escaped value"].AsString(), "with \"quotes\" inside of it");
+  // views see the source, copies do not
+  source[31] = 'A';
+  EXPECT_EQ(json["a key longer than fifteen"].AsString(), "A value longer than fifteen");
+  EXPECT_EQ(copy["a key longer than fifteen"].AsString(), "a value longer than fifteen");
+  EXPECT_EQ(json["escaped value"].AsString(), "with \"quotes\" inside of it");
+  EXPECT_EQ(json["short"].AsString(), "abc");
+
+  Json::Document doc;
+  const Json& root = doc.Parse("[\"viewed from the document source\"]", Json::kParseStringViews);
+  EXPECT_EQ(root[0].AsString(), "viewed from the document source");
+}
+
+TEST_F(JsonTest, DuplicateKeys) {
+  Json json = Json::Parse("{\"a\": [1], \"a\": [2, 3]}");
+  EXPECT_EQ(json.Keys().size(), 1u);
+  EXPECT_EQ(json["a"].Size(), 1);
+}
+
+TEST_F(JsonTest, NumberParsing) {
+  const char* literals[] = {
+      "0", "-0", "1", "-1", "9007199254740993", "18446744073709551615", "123456789012345678901234",
+      "0.1", "0.3", "-0.000001234", "1e22", "1e23", "4.9e-324", "2.2250738585072014e-308",
+      "1.7976931348623157e308", "1e309", "1e-400", "0.10000000000000000555", "3.14159265358979323846",
+      "100000000000000000000000e-10", "7.561e2", "81.0E+17", "0e999999", "123.456e-7"};
+  for (size_t i = 0; i < sizeof(literals) / sizeof(*literals); ++i) {
+    EXPECT_EQ(Json::Parse(literals[i]).AsDouble(), strtod(literals[i], 0)) << literals[i];
+  }
+  srand(2013);
+  char literal[64];
+  for (int i = 0; i < 20000; ++i) {
+    snprintf(literal, sizeof(literal), "%d%d.%de%d", 1 + rand() % 999, rand(), rand() % 100000, rand() % 60 - 30);
+    EXPECT_EQ(Json::Parse(literal).AsDouble(), strtod(literal, 0)) << literal;
+  }
+  EXPECT_EQ(Json::Parse("[20130192]")[0].AsInt(), 20130192);
+}
+
+TEST_F(JsonTest, SyntaxErrorMessages) {
+  const char* cases[][2] = {
+      {"[1, 2, 3, 4, ]", "SyntaxError: Unexpected token ] at pos 13"},
+      {"023", "SyntaxError: Unexpected token 2 at pos 1"},
+      {"-0.32b", "SyntaxError: Unexpected token b at pos 5"},
+      {"1.", "SyntaxError: Unexpected end of input"},
+      {"{ \"year\": 2013, month: 8 }", "SyntaxError: Unexpected token m at pos 16"},
+      {"\"wrong escape \\p\"", "SyntaxError: Unexpected token p at pos 15"}};
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+    try {
+      Json::Parse(cases[i][0]);
+      FAIL() << "Expected parse error: " << cases[i][0];
+    } catch (exception& e) {
+      EXPECT_STREQ(e.what(), cases[i][1]);
+    }
+  }
+}
+
+TEST_F(JsonTest, LongWhitespacesAndStrings) {
+  for (int n = 0; n < 100; ++n) {
+    string spaces;
+    for (int i = 0; i < n; ++i) spaces += " \t\r\n"[i % 4];
+    Json json = Json::Parse((spaces + "[" + spaces + "1" + spaces + "," + spaces + "2" + spaces + "]" + spaces).c_str());
+    EXPECT_EQ(json.Size(), 2);
+    string plain(n, 'x');
+    EXPECT_EQ(Json::Parse(("\"" + plain + "\"").c_str()).AsString(), plain);
+    EXPECT_EQ(Json::Parse(("\"" + plain + "\\n" + plain + "\"").c_str()).AsString(), plain + "\n" + plain);
+    EXPECT_THROW(Json::Parse(("\"" + plain + "\t\"").c_str()), exception);
+    EXPECT_THROW(Json::Parse(("\"" + plain).c_str()), exception);
+    EXPECT_THROW(Json::Parse((spaces + "[1" + spaces).c_str()), exception);
+  }
+}
+
+TEST_F(JsonTest, StructuralIndex) {
+  const char* files[] = {"./testcases-right.txt", "./testcases-wrong.txt"};
+  for (int f = 0; f < 2; ++f) {
+    ifstream ifs(files[f]);
+    string line;
+    while (getline(ifs, line)) {
+      if (line.find("#") == 0) {
+        continue;
+      }
+      string expected, actual;
+      try {
+        expected = Json::Parse(line.c_str()).ToString();
+      } catch (exception& e) {
+        expected = e.what();
+      }
+      try {
+        actual = Json::Parse(line.c_str(), Json::kParseStructuralIndex).ToString();
+      } catch (exception& e) {
+        actual = e.what();
+      }
+      EXPECT_EQ(actual, expected) << line;
+    }
+  }
+  // escapes, strings and scalars straddling the 64-byte blocks
+  for (int n = 0; n < 140; ++n) {
+    string pad(n, ' ');
+    string slashes(n % 7, '\\');
+    string text = pad + "{\"k" + slashes + slashes + "\\\"\": [" + pad + "12345.5e-3, \"" + string(n, 'x') +
+                  "\", true,null" + pad + ",{\"\":false}], \"b\\\\\":\"]\"}" + pad;
+    EXPECT_EQ(Json::Parse(text.c_str(), Json::kParseStructuralIndex).ToString(), Json::Parse(text.c_str()).ToString());
+    Json::Document doc;
+    EXPECT_EQ(doc.Parse(text.c_str(), Json::kParseStructuralIndex | Json::kParseStringViews).ToString(),
+              Json::Parse(text.c_str()).ToString());
+    EXPECT_THROW(Json::Parse((text + "1").c_str(), Json::kParseStructuralIndex), exception);
+    EXPECT_THROW(Json::Parse(text.substr(0, text.size() - n - 1).c_str(), Json::kParseStructuralIndex), exception);
+  }
+}
+
+namespace {
+// records the events as text, stops after \em limit events
+struct Recorder : Json::BaseHandler {
+  string events;
+  int limit;
+  Recorder(int n = -1) : limit(n) {}
+  bool Record(const string& event) {
+    events += event + " ";
+    return --limit != 0;
+  }
+  bool Null() { return Record("null"); }
+  bool Bool(bool b) { return Record(b ? "true" : "false"); }
+  bool Number(double d) { return Record(Json(d).ToString()); }
+  bool String(const char* str, size_t size) { return Record("s:" + string(str, size)); }
+  bool Key(const char* str, size_t size) { return Record("k:" + string(str, size)); }
+  bool StartObject() { return Record("{"); }
+  bool EndObject() { return Record("}"); }
+  bool StartArray() { return Record("["); }
+  bool EndArray() { return Record("]"); }
+};
+
+struct SumIds : Json::BaseHandler {
+  double sum;
+  bool is_id;
+  SumIds() : sum(0), is_id(false) {}
+  bool Key(const char* str, size_t size) {
+    is_id = string(str, size) == "id";
+    return true;
+  }
+  bool Number(double number) {
+    if (is_id) sum += number;
+    return true;
+  }
+};
+}  // namespace
+
+TEST_F(JsonTest, ParseEvents) {
+  const char* source = " {\"a\": [1, \"x\\ty\", true, null, {}], \"b\": {\"c\": false}, \"d\": []} ";
+  const char* expected = "{ k:a [ 1 s:x\ty true null { } ] k:b { k:c false } k:d [ ] } ";
+  for (Json::ParseFlag flags : {Json::kParseDefault, Json::kParseStructuralIndex}) {
+    Recorder all;
+    EXPECT_TRUE(Json::ParseEvents(source, all, flags));
+    EXPECT_EQ(all.events, expected);
+    // stop at the 5th event, nothing after it is checked or sent
+    Recorder some(5);
+    EXPECT_FALSE(Json::ParseEvents("[1, 2, 3, {\"k\": 4}, 5, oops", some, flags));
+    EXPECT_EQ(some.events, "[ 1 2 3 { ");
+    // handlers ignoring every event still validate the input
+    Json::BaseHandler nothing;
+    EXPECT_TRUE(Json::ParseEvents(source, nothing, flags));
+    EXPECT_THROW(Json::ParseEvents("[1, 2", nothing, flags), exception);
+    EXPECT_THROW(Json::ParseEvents("{\"a\" 1}", nothing, flags), exception);
+    SumIds sum;
+    Json::ParseEvents("[{\"id\": 1}, {\"id\": 2, \"tags\": [3]}]", sum, flags);
+    EXPECT_EQ(sum.sum, 3);
+  }
+}
+
+TEST_F(JsonTest, PushParser) {
+  const char* files[] = {"./testcases-right.txt", "./testcases-wrong.txt"};
+  for (int f = 0; f < 2; ++f) {
+    ifstream ifs(files[f]);
+    string line;
+    while (getline(ifs, line)) {
+      if (line.find("#") == 0) {
+        continue;
+      }
+      // split at every position: mid-string, mid-escape, mid-number, mid-literal
+      for (size_t chunk = 1; chunk <= line.size(); ++chunk) {
+        Json::PushParser parser;
+        vector<string> values;
+        try {
+          for (size_t i = 0; i < line.size(); i += chunk) {
+            parser.Feed(line.data() + i, min(chunk, line.size() - i));
+          }
+          parser.Finish();
+          Json json;
+          while (parser.Next(json)) values.push_back(json.ToString());
+        } catch (exception& e) {
+          values.push_back(e.what());
+          values.push_back("threw");
+        }
+        if (f == 0) {
+          ASSERT_EQ(values.size(), 1u) << line;
+          EXPECT_EQ(values[0], Json::Parse(line.c_str()).ToString()) << line;
+        } else {
+          EXPECT_NE(values.size(), 1u) << line;
+        }
+      }
+    }
+  }
+
+  Json::PushParser parser;
+  const char* stream = "{\"a\": [1, 2]}\n\"x\\u00e9\"[true, null]{} 12";
+  for (const char* p = stream; *p; ++p) parser.Feed(p, 1);
+  Json json;
+  vector<string> values;
+  while (parser.Next(json)) values.push_back(json.ToString());
+  ASSERT_EQ(values.size(), 4u);
+  EXPECT_EQ(values[1], "\"x\xc3\xa9\"");
+  EXPECT_EQ(values[3], "{  }");
+  // 12 is not closed before Finish()
+  parser.Finish();
+  EXPECT_TRUE(parser.Next(json));
+  EXPECT_EQ(json.AsInt(), 12);
+  EXPECT_FALSE(parser.Next(json));
+
+  // positions count from the start of the stream
+  parser.Reset();
+  parser.Feed("[1, 2]\n", 7);
+  try {
+    parser.Feed("[3, 4, ]", 8);
+    FAIL() << "Expected parse error";
+  } catch (exception& e) {
+    EXPECT_STREQ(e.what(), "SyntaxError: Unexpected token ] at pos 14");
+  }
+  parser.Reset();
+  parser.Feed("{\"a\": tr", 8);
+  EXPECT_THROW(parser.Finish(), exception);
+}
+
+TEST_F(JsonTest, ParseLines) {
+  string data;
+  for (int i = 0; i < 50000; ++i) {
+    char line[128];
+    snprintf(line, sizeof(line), "{\"id\": %d, \"tags\": [\"t%d\", %d.5]}%s", i, i % 7, i, i % 3 ? "\n" : "\r\n");
+    data += line;
+    if (i % 1000 == 0) data += "  \n";  // blank lines are skipped
+  }
+  data += "[\"no newline at the end\"]";
+  for (unsigned threads = 0; threads <= 4; threads += 2) {
+    int count = 0;
+    bool in_order = true;
+    size_t last_line = 0;
+    Json last;
+    Json::ParseLines(data.data(), data.size(), [&](size_t line, Json& json) {
+      if (count < 50000) {
+        in_order = in_order && json["id"].AsInt() == count;
+      }
+      in_order = in_order && (count == 0 || line > last_line);
+      last_line = line;
+      last = std::move(json);
+      ++count;
+    }, threads);
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(count, 50001);
+    EXPECT_EQ(last_line, 50050u);
+    EXPECT_EQ(last[0].AsString(), "no newline at the end");
+  }
+
+  // the values before a syntax error are delivered, then it is thrown
+  string bad = data.substr(0, data.size() / 2) + "\n[1, 2, ]\n" + data;
+  int count = 0;
+  EXPECT_THROW(Json::ParseLines(bad.data(), bad.size(), [&](size_t, Json&) { ++count; }, 4), exception);
+  EXPECT_GT(count, 20000);
+  EXPECT_LT(count, 30000);
+  // the message tells the line of the error, counting from 0 like the callback
+  string lines;
+  for (int i = 0; i < 20000; ++i) lines += "[1,2]\n";  // past the first chunk
+  lines += "[1, 2, ]\n";
+  for (int i = 0; i < 100000; ++i) lines += "[1,2]\n";
+  for (unsigned threads = 0; threads <= 4; threads += 4) {
+    try {
+      Json::ParseLines(lines.data(), lines.size(), [](size_t, Json&) {}, threads);
+      ADD_FAILURE() << "no syntax error";
+    } catch (const exception& error) {
+      EXPECT_STREQ(error.what(), "SyntaxError: Unexpected token ] at pos 7 on line 20000");
+    }
+  }
+  // so is an exception from the callback
+  count = 0;
+  EXPECT_THROW(Json::ParseLines(data.data(), data.size(), [&](size_t, Json&) {
+    if (++count == 100) throw runtime_error("stop");
+  }), runtime_error);
+  EXPECT_EQ(count, 100);
+  Json::ParseLines("", 0, [&](size_t, Json&) { FAIL(); });
+}
+
+TEST_F(JsonTest, ParseLengthBounded) {
+  const char* files[] = {"./testcases-right.txt", "./testcases-wrong.txt"};
+  for (int f = 0; f < 2; ++f) {
+    ifstream ifs(files[f]);
+    string line;
+    while (getline(ifs, line)) {
+      if (line.find("#") == 0) {
+        continue;
+      }
+      // exactly sized, with no NUL after it (the address sanitizer catches reads past it)
+      vector<char> exact(line.begin(), line.end());
+      const char* data = exact.empty() ? "" : &exact[0];
+      for (Json::ParseFlag flags : {Json::kParseDefault, Json::kParseStructuralIndex}) {
+        string expected, actual;
+        try {
+          expected = Json::Parse(line.c_str(), flags).ToString();
+        } catch (exception& e) {
+          expected = e.what();
+        }
+        try {
+          actual = Json::Parse(data, exact.size(), flags).ToString();
+        } catch (exception& e) {
+          actual = e.what();
+        }
+        EXPECT_EQ(actual, expected) << line;
+      }
+    }
+  }
+  const char* buffer = "[1, 2]12345\"abc\"truex";
+  auto slice = [&](size_t offset, size_t size) { return Json::Parse(buffer + offset, size); };
+  EXPECT_EQ(slice(0, 6).Size(), 2);
+  EXPECT_EQ(slice(6, 2).AsInt(), 12);
+  EXPECT_EQ(slice(11, 5).AsString(), "abc");
+  EXPECT_THROW(slice(11, 4), exception);
+  EXPECT_TRUE(slice(16, 4).AsBool());
+  EXPECT_THROW(slice(16, 3), exception);
+  Json::Document doc;
+  EXPECT_EQ(doc.Parse(buffer + 7, strlen("234"), Json::kParseStructuralIndex).AsInt(), 234);
+  // a NUL inside the slice is a character like any other, not the end
+  const string nuls[] = {string("[1]\0garbage", 11), string("1\0 2", 4), string("[1,\0]", 5), string("\"a\0b\"", 5),
+                         string("{\"k\": 1}\0", 9), string("\0", 1)};
+  for (Json::ParseFlag flags : {Json::kParseDefault, Json::kParseStructuralIndex}) {
+    for (size_t i = 0; i < sizeof(nuls) / sizeof(nuls[0]); ++i) {
+      string message;
+      try {
+        Json::Parse(nuls[i].data(), nuls[i].size(), flags);
+      } catch (exception& e) {
+        message = e.what();
+      }
+      EXPECT_EQ(message, "SyntaxError: Unexpected token 0(ASCII) at pos " + std::to_string(nuls[i].find('\0'))) << i;
+    }
+  }
+  EXPECT_THROW(Json::Parse("[1", 2), exception);
+  EXPECT_EQ(Json::Parse("[1] \0", 4).Size(), 1);
+  // lengths of any integer type are lengths, never flags
+  const uint32_t length = 6;
+  const unsigned short digits = 2;
+  EXPECT_EQ(Json::Parse(buffer, length).Size(), 2);
+  EXPECT_EQ(Json::Parse(buffer + 6, digits).AsInt(), 12);
+  EXPECT_EQ(Json::Parse(buffer, 6).Size(), 2);
+  EXPECT_EQ(doc.Parse(buffer, length).Size(), 2);
+  EXPECT_EQ(Json::Parse(buffer, length, Json::kParseStringViews | Json::kParseInternKeys).Size(), 2);
+}
+
+TEST_F(JsonTest, ParseFile) {
+  const char* path = "./jsonla_test_file.json";
+  {
+    ofstream ofs(path);
+    ofs << "{ \"name\": \"a long name not stored inline\", \"ids\": [1, 2, 3] }\n";
+  }
+  Json json = Json::ParseFile(path, Json::kParseStringViews);
+  remove(path);
+  EXPECT_EQ(json["name"].AsString(), "a long name not stored inline");
+  EXPECT_EQ(json["ids"].Size(), 3);
+  try {
+    Json::ParseFile(path);
+    FAIL() << "Expected file error";
+  } catch (exception& e) {
+    EXPECT_NE(string(e.what()).find("jsonla_test_file.json"), string::npos);
+  }
+}
+
+TEST_F(JsonTest, Writer) {
+  string text = "{ \"a\": [ 1, 2.5, \"x\\ny\\u0001\\\"\", true, null, {  } ], \"b\": [  ] }";
+  Json json = Json::Parse(text.c_str());
+  EXPECT_EQ(json.ToString(), text);
+  for (int i = 0; i < 2000; ++i) json["a"].Push(Json("a string long enough to fill the staging buffers"));
+  string expected = json.ToString();
+
+  // appended to what the string holds
+  string out = "prefix ";
+  Json::Writer writer(out);
+  writer.Write(json).Write(Json(1)).Flush();
+  EXPECT_EQ(out, "prefix " + expected + "1");
+  EXPECT_EQ(writer.Size(), expected.size() + 1);
+
+  // a fixed buffer is filled, the rest is counted
+  vector<char> buffer(100);
+  Json::Writer fixed(&buffer[0], buffer.size());
+  fixed.Write(json);
+  EXPECT_TRUE(fixed.Truncated());
+  EXPECT_EQ(fixed.Size(), expected.size());
+  EXPECT_EQ(string(buffer.begin(), buffer.end()), expected.substr(0, 100));
+  char small[64];
+  Json::Writer fits(small, sizeof(small));
+  fits.Write(Json::Parse("[1, 2]"));
+  EXPECT_FALSE(fits.Truncated());
+  EXPECT_EQ(string(small, fits.Size()), "[ 1, 2 ]");
+
+  // files and descriptors
+  for (int sink = 0; sink < 2; ++sink) {
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    if (sink == 0) {
+      Json::Writer(file).Write(json);
+    } else {
+      Json::Writer(fileno(file)).Write(json);
+    }
+    rewind(file);
+    string read;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) read.append(chunk, n);
+    fclose(file);
+    EXPECT_EQ(read, expected);
+  }
+
+  // the write errors come out of Write() or Flush(), the destructor drops them
+  FILE* read_only = fopen("./testcases-right.txt", "r");
+  ASSERT_TRUE(read_only != NULL);
+  const char* sinks[] = {"FileError: FILE* sink: ", "FileError: file descriptor sink: "};
+  for (int sink = 0; sink < 2; ++sink) {
+    try {
+      if (sink == 0) {
+        Json::Writer(read_only).Write(json).Flush();
+      } else {
+        Json::Writer(fileno(read_only)).Write(json).Flush();
+      }
+      ADD_FAILURE() << "no write error";
+    } catch (const exception& error) {
+      EXPECT_EQ(string(error.what()).find(sinks[sink]), 0u) << error.what();
+    }
+  }
+  Json::Writer(fileno(read_only)).Write(Json(1));  // staged only, the error is dropped
+  fclose(read_only);
+}
+
+TEST_F(JsonTest, NumberFormatting) {
+  const char* cases[][2] = {
+      {"20130192", "20130192"}, {"-0", "-0"}, {"0.1", "0.1"}, {"-1.5", "-1.5"}, {"1e21", "1e21"},
+      {"1e20", "100000000000000000000"}, {"1e23", "1e23"}, {"1e-7", "1e-7"}, {"0.000001", "0.000001"},
+      {"5e-324", "5e-324"}, {"1.7976931348623157e308", "1.7976931348623157e308"}, {"123.456e-7", "0.0000123456"}};
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+    EXPECT_EQ(Json::Parse(cases[i][0]).ToString(), cases[i][1]) << cases[i][0];
+  }
+  EXPECT_EQ(Json(1e308 * 10).ToString(), "null");
+  srand(1110);
+  for (int i = 0; i < 100000; ++i) {
+    uint64_t bits = static_cast<uint64_t>(rand()) << 42 ^ static_cast<uint64_t>(rand()) << 21 ^ rand();
+    double number;
+    memcpy(&number, &bits, sizeof(number));
+    if (number - number != 0) continue;  // NaN or infinite
+    string text = Json(number).ToString();
+    EXPECT_EQ(Json::Parse(text.c_str()).AsDouble(), number) << text;
+    string digits = text.substr(0, text.find('e'));
+    digits.erase(std::remove_if(digits.begin(), digits.end(), [](char ch) { return !isdigit(ch); }), digits.end());
+    digits.erase(0, digits.find_first_not_of('0'));
+    digits.erase(digits.find_last_not_of('0') + 1);
+    char shorter[32];
+    snprintf(shorter, sizeof(shorter), "%.*e", static_cast<int>(digits.size()) - 2, number);
+    EXPECT_TRUE(digits.size() < 2 || strtod(shorter, 0) != number) << text;
+  }
+}
+
+TEST_F(JsonTest, ObjectMembers) {
+  Json json = Json::Parse("{\"zeta\": 1, \"alpha\": 2, \"mid\": 3}");
+  EXPECT_EQ(json.ToString(), "{ \"zeta\": 1, \"alpha\": 2, \"mid\": 3 }");
+  json["beta"] = 4;
+  json.Remove("alpha");
+  EXPECT_EQ(json.ToString(), "{ \"zeta\": 1, \"mid\": 3, \"beta\": 4 }");
+
+  // large objects are indexed, lookups, removals and duplicates still work
+  string text = "{";
+  for (int i = 0; i < 1000; ++i) text += (i ? ", \"key" : "\"key") + std::to_string(i) + "\": " + std::to_string(i);
+  text += ", \"key500\": -1}";
+  for (int pass = 0; pass < 2; ++pass) {
+    Json::Document doc;
+    Json parsed = Json::Parse(text.c_str());
+    const Json& big = pass ? doc.Parse(text.c_str()) : parsed;
+    EXPECT_EQ(big.Keys().size(), 1000u);
+    EXPECT_EQ(big.Keys()[999], "key999");
+    for (int i = 0; i < 1000; ++i) EXPECT_EQ(big[("key" + std::to_string(i)).c_str()].AsInt(), i);
+    EXPECT_FALSE(big.Contains("key1000"));
+  }
+  Json big = Json::Parse(text.c_str());
+  for (int i = 0; i < 1000; i += 2) big.Remove("key" + std::to_string(i));
+  EXPECT_EQ(big.Keys().size(), 500u);
+  EXPECT_FALSE(big.Contains("key500"));
+  EXPECT_EQ(big["key501"].AsInt(), 501);
+  Json copy = big;
+  copy.AddProperty("key0", Json(0));
+  EXPECT_EQ(copy.Keys().back(), "key0");
+  EXPECT_EQ(copy["key999"].AsInt(), 999);
+
+  // a long key which is dropped or left pending belongs to the arena
+  Json::Document doc;
+  EXPECT_THROW(doc.Parse("{\"a key longer than fifteen\": "), std::exception);
+  EXPECT_EQ(doc.Parse("{\"a key longer than fifteen\": 1, \"a key longer than fifteen\": 2}").ToString(),
+            "{ \"a key longer than fifteen\": 1 }");
+}
+
+TEST_F(JsonTest, ArrayElements) {
+  Json json = Json::Parse("[\"a string longer than 15\", [1, 2], {\"id\": 3}]");
+  for (int i = 0; i < 3; ++i) json.Push(json[i]);
+  json.Push(std::move(json[0]));
+  EXPECT_EQ(json.ToString(),
+            "[ null, [ 1, 2 ], { \"id\": 3 }, \"a string longer than 15\", [ 1, 2 ], { \"id\": 3 }, "
+            "\"a string longer than 15\" ]");
+  json.Remove(0);
+  EXPECT_EQ(json[0][1].AsInt(), 2);
+  EXPECT_EQ(json.Size(), 6);
+
+  string text = "[";
+  for (int i = 0; i < 100000; ++i) text += (i ? ", [" : "[") + std::to_string(i) + ", \"x\"]";
+  text += "]";
+  Json::Document doc;
+  const Json& big = doc.Parse(text.c_str());
+  Json copy = big;
+  double sum = 0;
+  for (int i = 0; i < copy.Size(); ++i) sum += copy[i][0].AsDouble() - big[i][0].AsDouble() + copy[i][0].AsDouble();
+  EXPECT_EQ(sum, 99999.0 * 100000 / 2);
+}
+
+TEST_F(JsonTest, InternedKeys) {
+  const Json::Key kId("id"), kLong("a key longer than fifteen"), kMissing("missing");
+  EXPECT_EQ(Json::Key(string("a key longer than fifteen")).Data(), kLong.Data());
+  EXPECT_EQ(kLong.ToString(), "a key longer than fifteen");
+
+  string text = "[";
+  for (int i = 0; i < 100; ++i) text += (i ? ", {" : "{") + string("\"id\": ") + std::to_string(i) + ", \"a key longer than fifteen\": true}";
+  text += "]";
+  for (Json::ParseFlag flags : {Json::kParseDefault, Json::kParseInternKeys}) {
+    Json json = Json::Parse(text.c_str(), flags);
+    Json::Document doc;
+    const Json& docs = doc.Parse(text.c_str(), flags | Json::kParseStringViews);
+    for (int i = 0; i < 100; ++i) {
+      EXPECT_EQ(json[i][kId].AsInt(), i);
+      EXPECT_TRUE(json[i][kLong].AsBool());
+      EXPECT_TRUE(docs[i][kLong].AsBool());
+      EXPECT_FALSE(json[i].Contains(kMissing));
+    }
+    EXPECT_EQ(json.ToString(), Json::Parse(text.c_str()).ToString());
+    Json copy = docs[99];
+    EXPECT_EQ(copy.ToString(), "{ \"id\": 99, \"a key longer than fifteen\": true }");
+  }
+
+  // keys added through a Key, also in indexed objects
+  Json big = Json::Parse("{}");
+  for (int i = 0; i < 100; ++i) big[Json::Key("key" + std::to_string(i))] = i;
+  big[kLong] = "long";
+  EXPECT_EQ(big.Keys().size(), 101u);
+  EXPECT_EQ(big["key42"].AsInt(), 42);
+  EXPECT_EQ(big["a key longer than fifteen"].AsString(), "long");
+  EXPECT_TRUE(big.Contains(Json::Key("key99")));
+  EXPECT_FALSE(big.Contains(kMissing));
+}
+
+TEST_F(JsonTest, ConstLookups) {
+  string text = "{";
+  for (int i = 0; i < 200; ++i) text += (i ? ", \"/route/" : "\"/route/") + std::to_string(i) + "\": " + std::to_string(i);
+  text += ", \"small\": {\"a\": 1}}";
+  const Json routes = Json::Parse(text.c_str());
+  EXPECT_TRUE(routes["/route/404"].IsNull());
+  EXPECT_TRUE(routes[Json::Key("/route/404")].IsNull());
+  EXPECT_TRUE(routes["small"]["b"].IsNull());
+  EXPECT_EQ(routes.Find("/route/404"), static_cast<const Json*>(0));
+  EXPECT_EQ(routes.Find("small")->Find("a")->AsInt(), 1);
+  EXPECT_EQ(routes["/route/7"].Find("x"), static_cast<const Json*>(0));
+  EXPECT_EQ(routes.Keys().size(), 201u);
+  EXPECT_EQ(routes["small"].Keys().size(), 1u);
+
+  std::vector<std::thread> readers;
+  std::atomic<int> found(0);
+  for (int t = 0; t < 8; ++t) {
+    readers.push_back(std::thread([&routes, &found, t]() {
+      const Json::Key key("/route/" + std::to_string(t));
+      for (int i = 0; i < 2000; ++i) {
+        const Json* route = routes.Find(("/route/" + std::to_string(i)).c_str());
+        if (route && route->AsInt() == i && routes[key].AsInt() == t && routes["small"]["missing"].IsNull()) ++found;
+      }
+    }));
+  }
+  for (size_t t = 0; t < readers.size(); ++t) readers[t].join();
+  EXPECT_EQ(found, 8 * 200);
+  EXPECT_EQ(routes.Keys().size(), 201u);
+
+  Json json = Json::Parse("{}");
+  json.Find("x");
+  EXPECT_TRUE(json.IsEmpty());
+  json["x"] = 1;
+  EXPECT_EQ(json.Find("x")->AsInt(), 1);
+  EXPECT_EQ(json.ToString(), "{ \"x\": 1 }");
+
+  // a non-const Json object, shared with a copy, is read the same way and stays shared
+  Json shared = Json::Parse(text.c_str());
+  const Json before = shared;
+  const Json::Key small("small");
+  const Json::Pointer a("/small/a");
+  std::vector<std::thread> lookups;
+  std::atomic<int> hits(0);
+  for (int t = 0; t < 8; ++t) {
+    lookups.push_back(std::thread([&shared, &small, &a, &hits]() {
+      for (int i = 0; i < 200; ++i) {
+        const Json* route = shared.Find(("/route/" + std::to_string(i)).c_str());
+        if (route && route->AsInt() == i && shared.Find(small)->Find("a") == shared.Find(a)) ++hits;
+      }
+    }));
+  }
+  for (size_t t = 0; t < lookups.size(); ++t) lookups[t].join();
+  EXPECT_EQ(hits, 8 * 200);
+  Json after = shared;
+  EXPECT_EQ(before.Find(a), shared.Find(a));
+  EXPECT_EQ(after.Find(a), shared.Find(a));
+}
+
+struct IntegerRecorder : Json::BaseHandler {
+  std::vector<string> events;
+  bool Number(double d) { events.push_back("d" + Json(d).ToString()); return true; }
+  bool Int64(int64_t i) { events.push_back("i" + std::to_string(i)); return true; }
+  bool UInt64(uint64_t u) { events.push_back("u" + std::to_string(u)); return true; }
+};
+
+struct DoubleRecorder : Json::BaseHandler {
+  std::vector<double> numbers;
+  bool Number(double d) { numbers.push_back(d); return true; }
+};
+
+TEST_F(JsonTest, Integers) {
+  const char* text = "[9007199254740993, -9223372036854775808, 18446744073709551615, 18446744073709551616, "
+                     "-9223372036854775809, 0, -0, 1.0, 1e2, 12345678901234567890.0]";
+  Json json = Json::Parse(text);
+  EXPECT_EQ(json.ToString(),
+            "[ 9007199254740993, -9223372036854775808, 18446744073709551615, 18446744073709552000, "
+            "-9223372036854776000, 0, -0, 1, 100, 12345678901234567000 ]");
+  bool integers[] = {true, true, true, false, false, true, false, false, false, false};
+  for (int i = 0; i < json.Size(); ++i) EXPECT_EQ(json[i].IsInteger(), integers[i]) << i;
+  EXPECT_EQ(json[0].AsInt64(), 9007199254740993LL);
+  EXPECT_EQ(json[1].AsInt64(), INT64_MIN);
+  EXPECT_EQ(json[2].AsUInt64(), UINT64_MAX);
+  EXPECT_EQ(json[9].AsUInt64(), 12345678901234567168ULL);
+  EXPECT_EQ(json[7].AsInt64(), 1);
+  EXPECT_THROW(json[2].AsInt64(), std::exception);
+  EXPECT_THROW(json[1].AsUInt64(), std::exception);
+  EXPECT_THROW(json[3].AsUInt64(), std::exception);
+  EXPECT_EQ(Json(json)[0].AsInt64(), 9007199254740993LL);
+  EXPECT_EQ(Json::Parse(text, Json::kParseStructuralIndex).ToString(), json.ToString());
+
+  Json value(static_cast<uint64_t>(42));
+  EXPECT_TRUE(value.IsInteger());
+  EXPECT_EQ(value.AsInt64(), 42);
+  value = static_cast<int64_t>(-7);
+  EXPECT_EQ(value.ToString(), "-7");
+  value = UINT64_MAX;
+  EXPECT_EQ(value.ToString(), "18446744073709551615");
+  value = 2.5;
+  EXPECT_FALSE(value.IsInteger());
+  EXPECT_EQ(Json(3).ToString(), "3");
+
+  IntegerRecorder exact;
+  Json::ParseEvents("[1, -2, 18446744073709551615, 2.5]", exact);
+  string events;
+  for (size_t i = 0; i < exact.events.size(); ++i) events += exact.events[i] + " ";
+  EXPECT_EQ(events, "i1 i-2 u18446744073709551615 d2.5 ");
+  DoubleRecorder doubles;
+  Json::ParseEvents("[1, -2, 2.5]", doubles);
+  EXPECT_EQ(doubles.numbers, std::vector<double>({1, -2, 2.5}));
+
+  Json::PushParser parser;
+  parser.Feed("[9007199254740993", 17);
+  parser.Feed("]", 1);
+  Json pushed;
+  ASSERT_TRUE(parser.Next(pushed));
+  EXPECT_EQ(pushed[0].AsInt64(), 9007199254740993LL);
+}
+
+TEST_F(JsonTest, Pointers) {
+  const char* text = "{\"users\": [{\"name\": \"ggicci\", \"tags\": [\"dog\", \"anime\"]}, {\"name\": \"ann\"}], "
+                     "\"a/b\": 1, \"m~n\": 2, \"\": 3, \"01\": 4, \"7\": 5}";
+  Json json = Json::Parse(text);
+  EXPECT_EQ(json.Find(Json::Pointer("")), &json);
+  EXPECT_EQ(json.Find(Json::Pointer("/users/0/name"))->AsString(), "ggicci");
+  EXPECT_EQ(json.Find(Json::Pointer("/users/0/tags/1"))->AsString(), "anime");
+  EXPECT_EQ(json.Find(Json::Pointer("/a~1b"))->AsInt(), 1);
+  EXPECT_EQ(json.Find(Json::Pointer("/m~0n"))->AsInt(), 2);
+  EXPECT_EQ(json.Find(Json::Pointer("/"))->AsInt(), 3);
+  EXPECT_EQ(json.Find(Json::Pointer("/01"))->AsInt(), 4);
+  EXPECT_EQ(json.Find(Json::Pointer("/7"))->AsInt(), 5);
+  const char* missing[] = {"/users/2", "/users/01", "/users/-", "/users/0/name/x", "/nope", "/users/99999999999999999999999"};
+  for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); ++i) {
+    EXPECT_EQ(json.Find(Json::Pointer(missing[i])), static_cast<const Json*>(0)) << missing[i];
+  }
+  const char* wrong[] = {"users", "/a~", "/a~2"};
+  for (size_t i = 0; i < sizeof(wrong) / sizeof(wrong[0]); ++i) {
+    EXPECT_THROW(Json::Pointer bad(wrong[i]), std::exception) << wrong[i];
+  }
+  Json::Pointer pointer(string("/users/1/name"));
+  EXPECT_EQ(pointer.Depth(), 3u);
+  EXPECT_EQ(pointer.ToString(), "/users/1/name");
+  EXPECT_EQ(json.Find(pointer)->AsString(), "ann");
+  EXPECT_EQ(json.Find(pointer), &json["users"][1]["name"]);
+
+  Json::Pointers pointers;
+  EXPECT_EQ(pointers.Add(Json::Pointer("/users/0/tags/0")), 0u);
+  EXPECT_EQ(pointers.Add(Json::Pointer("/users/0/name")), 1u);
+  EXPECT_EQ(pointers.Add(Json::Pointer("/nope/x")), 2u);
+  EXPECT_EQ(pointers.Add(Json::Pointer("/users")), 3u);
+  EXPECT_EQ(pointers.Add(Json::Pointer("")), 4u);
+  EXPECT_EQ(pointers.Add(Json::Pointer("/users/0/name")), 1u);
+  EXPECT_EQ(pointers.Size(), 5u);
+  std::vector<const Json*> results(1, &json);
+  Json::Document doc;
+  doc.Parse(text).Find(pointers, results);
+  ASSERT_EQ(results.size(), 5u);
+  EXPECT_EQ(results[0]->AsString(), "dog");
+  EXPECT_EQ(results[1]->AsString(), "ggicci");
+  EXPECT_EQ(results[2], static_cast<const Json*>(0));
+  EXPECT_EQ(results[3]->Size(), 2);
+  EXPECT_EQ(results[4], &doc.Root());
+  Json::Parse("[1]").Find(pointers, results);
+  EXPECT_EQ(results[3], static_cast<const Json*>(0));
+  Json::Pointers none;
+  json.Find(none, results);
+  EXPECT_TRUE(results.empty());
+}
+
+TEST_F(JsonTest, Iterators) {
+  Json json = Json::Parse("{\"id\": 1, \"tags\": [\"dog\", \"anime\"], \"name\": \"ggicci\"}");
+  string keys;
+  for (const Json::Item& item : json.Items()) keys += string(item.key, item.key_size) + "=" + item.value.ToString() + " ";
+  EXPECT_EQ(keys, "id=1 tags=[ \"dog\", \"anime\" ] name=\"ggicci\" ");
+  for (Json::Item item : json.Items()) {
+    if (item.value.IsNumber()) item.value = 2;
+  }
+  EXPECT_EQ(json["id"].AsInt(), 2);
+
+  string tags;
+  for (Json& tag : json["tags"].Elements()) tag = tag.AsString() + "s";
+  const Json& view = json;
+  for (const Json& tag : view["tags"].Elements()) tags += tag.AsString() + " ";
+  EXPECT_EQ(tags, "dogs animes ");
+  EXPECT_EQ(std::count_if(view.Items().begin(), view.Items().end(),
+                          [](const Json::ConstItem& item) { return item.value.IsString(); }), 1);
+
+  EXPECT_TRUE(json["tags"].Items().empty());
+  EXPECT_TRUE(json.Elements().empty());
+  EXPECT_TRUE(Json::Parse("{}").Items().empty());
+  EXPECT_TRUE(Json::Parse("[]").Elements().empty());
+  EXPECT_TRUE(Json(3).Items().empty());
+
+  Json::Document doc;
+  const Json& root = doc.Parse("{\"a key longer than fifteen\": 1}", Json::kParseStringViews);
+  for (const Json::ConstItem& item : root.Items()) EXPECT_EQ(string(item.key, item.key_size), "a key longer than fifteen");
+}
+
+TEST_F(JsonTest, CopyOnWrite) {
+  const Json original = Json::Parse("{\"config\": {\"name\": \"a string longer than fifteen\", \"ports\": [80, 443]},"
+                                    " \"tags\": [\"dog\", {\"deep\": [1, 2]}]}");
+  const string text = original.ToString();
+  Json copy = original;
+  copy["config"]["ports"].Push(Json(8080));
+  copy["tags"][1]["deep"][0] = "changed";
+  copy.AddProperty("extra", Json(true));
+  copy["config"].Remove("name");
+  EXPECT_EQ(original.ToString(), text);
+  EXPECT_EQ(copy.ToString(), "{ \"config\": { \"ports\": [ 80, 443, 8080 ] }, \"tags\": [ \"dog\", { \"deep\": [ \"changed\", 2 ] } ], "
+                             "\"extra\": true }");
+
+  // references taken again after a copy write into the original only
+  Json json = Json::Parse("{\"a\": {\"b\": [1]}, \"c\": [\"x\"]}");
+  Json snapshot = json;
+  json["a"]["b"].Push(Json(2));
+  json["c"][0] = "y";
+  for (Json& element : json["c"].Elements()) element = element.AsString() + "!";
+  EXPECT_EQ(json.ToString(), "{ \"a\": { \"b\": [ 1, 2 ] }, \"c\": [ \"y!\" ] }");
+  EXPECT_EQ(snapshot.ToString(), "{ \"a\": { \"b\": [ 1 ] }, \"c\": [ \"x\" ] }");
+  Json again = json;
+  for (Json::Item item : json.Items()) item.value = Json();
+  EXPECT_EQ(again.ToString(), "{ \"a\": { \"b\": [ 1, 2 ] }, \"c\": [ \"y!\" ] }");
+
+  // a read-only walk through the non-const accessors keeps the copies sharing
+  Json records = Json::Parse("{\"data\": [{\"id\": 0}, {\"id\": 1}, {\"id\": 2}]}");
+  int ids = 0;
+  for (Json& record : records["data"].Elements()) ids += record["id"].AsInt();
+  for (Json::Item item : records.Items()) ids += item.value.Size();
+  EXPECT_EQ(ids, 6);
+  const Json::Pointer id("/data/2/id");
+  Json first = records;
+  Json second = records;
+  EXPECT_EQ(first.Find(id), records.Find(id));
+  EXPECT_EQ(second.Find(id), records.Find(id));
+  EXPECT_EQ(first.Hash(), records.Hash());
+  second["data"][2]["id"] = 7;
+  EXPECT_EQ(first.Find(id), records.Find(id));
+  EXPECT_EQ(second.Find(id)->AsInt(), 7);
+  EXPECT_EQ(records.Find(id)->AsInt(), 2);
+
+  // copies out of a document stay valid after it is gone
+  Json out;
+  {
+    Json::Document doc;
+    out = doc.Parse("{\"k\": [\"a string longer than fifteen\"]}");
+  }
+  Json shared = out;
+  EXPECT_EQ(shared["k"][0].AsString(), "a string longer than fifteen");
+
+  // so are the copies of values moved in from the input
+  string input = "[\"a string longer than fifteen\", [\"a string longer than fifteen\"], "
+                 "{\"m\": \"a string longer than fifteen\", \"o\": {\"p\": \"a string longer than fifteen\"}}, "
+                 "\"a string longer than fifteen\"]";
+  Json views = Json::Parse(input.c_str(), Json::kParseStringViews);
+  Json moved = Json::Parse("[]");
+  moved.Push(std::move(views[0]));
+  moved.Push(std::move(views[1]));
+  Json patched = Json::Parse("{\"o\": {}}");
+  patched.MergePatch(std::move(views[2]));
+  Json written = Json::Parse("{\"w\": [null]}");
+  written["w"][0] = std::move(views[3]);
+  Json moved_copy = moved;
+  Json patched_copy = patched;
+  Json written_copy = written;
+  for (size_t at = input.find("a string"); at != string::npos; at = input.find("a string", at)) input[at] = 'A';
+  EXPECT_EQ(moved_copy.ToString(), "[ \"a string longer than fifteen\", [ \"a string longer than fifteen\" ] ]");
+  EXPECT_EQ(patched_copy.ToString(), "{ \"o\": { \"p\": \"a string longer than fifteen\" }, \"m\": \"a string longer than fifteen\" }");
+  EXPECT_EQ(written_copy.ToString(), "{ \"w\": [ \"a string longer than fifteen\" ] }");
+
+  // many threads copy one template and change a couple of fields each
+  std::vector<std::thread> handlers;
+  std::atomic<int> good(0);
+  for (int t = 0; t < 8; ++t) {
+    handlers.push_back(std::thread([&original, &good, t]() {
+      for (int i = 0; i < 200; ++i) {
+        Json request = original;
+        request["config"]["ports"][0] = t;
+        request["tags"].Push(Json(i));
+        Json keep = request;
+        if (keep["config"]["ports"][0].AsInt() == t && keep["tags"].Size() == 3 &&
+            keep["config"]["name"].AsString() == "a string longer than fifteen") ++good;
+      }
+    }));
+  }
+  for (size_t t = 0; t < handlers.size(); ++t) handlers[t].join();
+  EXPECT_EQ(good, 8 * 200);
+  EXPECT_EQ(original.ToString(), text);
+}
+
+TEST_F(JsonTest, Patches) {
+  const char* pairs[][2] = {
+    {"{\"a\": 1, \"b\": {\"c\": [1, 2], \"d\": \"x\"}}", "{\"a\": 2, \"b\": {\"c\": [1, 2, 3]}, \"e\": null}"},
+    {"[1, 2, 3, 4, 5]", "[5, 1, 2, 3, 4]"},
+    {"[{\"id\": 1}, {\"id\": 2}, {\"id\": 3}]", "[{\"id\": 3}, {\"id\": 1, \"x\": true}, \"new\"]"},
+    {"[\"a\", \"b\", \"a\", \"c\"]", "[\"c\", \"a\", \"d\", \"a\"]"},
+    {"{\"k/~\": [[1], [2]]}", "{\"k/~\": [[2], [1], [0]]}"},
+    {"[1, 2]", "{\"now\": \"an object\"}"},
+    {"[]", "[1, [2], {}]"},
+  };
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+    Json from = Json::Parse(pairs[i][0]);
+    Json to = Json::Parse(pairs[i][1]);
+    Json patch = Json::Diff(from, to);
+    Json copy = from;
+    EXPECT_EQ(copy.ApplyPatch(patch).ToString(), to.ToString()) << patch.ToString();
+    EXPECT_EQ(from.ToString(), Json::Parse(pairs[i][0]).ToString());
+  }
+  EXPECT_EQ(Json::Diff(Json::Parse("[1, 2, 3, 4, 5]"), Json::Parse("[5, 1, 2, 3, 4]")).ToString(),
+            "[ { \"op\": \"move\", \"from\": \"/4\", \"path\": \"/0\" } ]");
+  EXPECT_EQ(Json::Diff(Json::Parse("{\"a\": 1}"), Json::Parse("{\"a\": 1.0}")).Size(), 0);
+
+  // the operations of RFC 6902, a failing one leaves the value unchanged
+  Json json = Json::Parse("{\"foo\": [\"bar\", \"baz\"], \"qux\": {\"a\": 1}}");
+  json.ApplyPatch(Json::Parse("[{\"op\": \"add\", \"path\": \"/foo/1\", \"value\": \"new\"},"
+                              " {\"op\": \"add\", \"path\": \"/foo/-\", \"value\": 4},"
+                              " {\"op\": \"copy\", \"from\": \"/qux\", \"path\": \"/copy\"},"
+                              " {\"op\": \"move\", \"from\": \"/qux/a\", \"path\": \"/foo/0\"},"
+                              " {\"op\": \"replace\", \"path\": \"/copy/a\", \"value\": 2},"
+                              " {\"op\": \"remove\", \"path\": \"/foo/2\"},"
+                              " {\"op\": \"test\", \"path\": \"/foo/0\", \"value\": 1.0}]"));
+  EXPECT_EQ(json.ToString(), "{ \"foo\": [ 1, \"bar\", \"baz\", 4 ], \"qux\": {  }, \"copy\": { \"a\": 2 } }");
+  const string text = json.ToString();
+  const char* wrong[] = {
+    "[{\"op\": \"add\", \"path\": \"/x\", \"value\": 1}, {\"op\": \"test\", \"path\": \"/x\", \"value\": 2}]",
+    "[{\"op\": \"remove\", \"path\": \"/missing\"}]",
+    "[{\"op\": \"replace\", \"path\": \"/foo/4\", \"value\": 1}]",
+    "[{\"op\": \"add\", \"path\": \"/foo/5\", \"value\": 1}]",
+    "[{\"op\": \"move\", \"from\": \"/qux\", \"path\": \"/qux/inner\"}]",
+    "[{\"op\": \"add\", \"path\": \"foo\", \"value\": 1}]",
+    "[{\"op\": \"jump\", \"path\": \"/foo\"}]",
+    "[{\"path\": \"/foo\"}]",
+    "{\"op\": \"remove\", \"path\": \"/foo\"}",
+    "[{\"op\": \"remove\", \"path\": \"/qux\"}, {\"op\": \"replace\", \"path\": \"/foo/0\", \"value\": 9},"
+    " {\"op\": \"move\", \"from\": \"/foo/1\", \"path\": \"/foo/0\"}, {\"op\": \"add\", \"path\": \"/foo/-\", \"value\": 5},"
+    " {\"op\": \"remove\", \"path\": \"/copy\"}, {\"op\": \"replace\", \"path\": \"\", \"value\": 1},"
+    " {\"op\": \"test\", \"path\": \"/x\", \"value\": 1}]",
+  };
+  for (size_t i = 0; i < sizeof(wrong) / sizeof(wrong[0]); ++i) {
+    EXPECT_THROW(json.ApplyPatch(Json::Parse(wrong[i])), exception) << wrong[i];
+    EXPECT_EQ(json.ToString(), text);
+  }
+
+  // in place: the references off the paths of the operations stay valid
+  Json& kept = json["copy"]["a"];
+  json.ApplyPatch(Json::Parse("[{\"op\": \"replace\", \"path\": \"/qux\", \"value\": 2}]"));
+  EXPECT_EQ(kept.AsInt(), 2);
+  EXPECT_EQ(json["qux"].AsInt(), 2);
+
+  // the members removed from an indexed object are put back in their places
+  Json big = Json::Parse("{}");
+  for (int i = 0; i < 40; ++i) big.AddProperty("key" + std::to_string(i), Json(i));
+  const string big_text = big.ToString();
+  EXPECT_THROW(big.ApplyPatch(Json::Parse("[{\"op\": \"remove\", \"path\": \"/key3\"}, {\"op\": \"move\", \"from\": \"/key7\", "
+                                          "\"path\": \"/key70\"}, {\"op\": \"remove\", \"path\": \"/key3\"}]")), exception);
+  EXPECT_EQ(big.ToString(), big_text);
+  EXPECT_EQ(big["key7"].AsInt(), 7);
+  EXPECT_FALSE(big.Contains("key70"));
+}
+
+TEST_F(JsonTest, MergePatch) {
+  // the examples of RFC 7386, appendix A
+  const char* cases[][3] = {
+    {"{\"a\":\"b\"}", "{\"a\":\"c\"}", "{ \"a\": \"c\" }"},
+    {"{\"a\":\"b\"}", "{\"b\":\"c\"}", "{ \"a\": \"b\", \"b\": \"c\" }"},
+    {"{\"a\":\"b\"}", "{\"a\":null}", "{  }"},
+    {"{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{ \"b\": \"c\" }"},
+    {"{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{ \"a\": \"c\" }"},
+    {"{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{ \"a\": [ \"b\" ] }"},
+    {"{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{ \"a\": { \"b\": \"d\" } }"},
+    {"{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{ \"a\": [ 1 ] }"},
+    {"[\"a\",\"b\"]", "[\"c\",\"d\"]", "[ \"c\", \"d\" ]"},
+    {"{\"a\":\"b\"}", "[\"c\"]", "[ \"c\" ]"},
+    {"{\"a\":\"foo\"}", "null", "null"},
+    {"{\"a\":\"foo\"}", "\"bar\"", "\"bar\""},
+    {"{\"e\":null}", "{\"a\":1}", "{ \"e\": null, \"a\": 1 }"},
+    {"[1,2]", "{\"a\":\"b\",\"c\":null}", "{ \"a\": \"b\" }"},
+    {"{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{ \"a\": { \"bb\": {  } } }"},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    Json json = Json::Parse(cases[i][0]);
+    Json patch = Json::Parse(cases[i][1]);
+    EXPECT_EQ(json.MergePatch(std::move(patch)).ToString(), cases[i][2]) << cases[i][1];
+    EXPECT_TRUE(patch.IsNull());
+  }
+
+  // layers shared with other copies are copied from, never changed
+  Json defaults = Json::Parse("{\"log\": {\"level\": \"info\", \"file\": \"a.log\"}, \"port\": 80}");
+  const Json layer = Json::Parse("{\"log\": {\"file\": null, \"rotate\": {\"size\": 10, \"keep\": null}}, \"port\": 8080}");
+  const string text = layer.ToString();
+  Json config = defaults;
+  config.MergePatch(Json(layer));
+  EXPECT_EQ(config.ToString(), "{ \"log\": { \"level\": \"info\", \"rotate\": { \"size\": 10 } }, \"port\": 8080 }");
+  EXPECT_EQ(layer.ToString(), text);
+  EXPECT_EQ(defaults["log"]["file"].AsString(), "a.log");
+  EXPECT_THROW(config.MergePatch(Json::Parse("{\"port\": {\"x\": 1}}"))["port"]["x"].AsString(), exception);
+
+  // a patch taken from the Json object it is merged into
+  Json json = Json::Parse("{\"a\": {\"b\": 1, \"c\": 2, \"d\": 3, \"e\": 4}}");
+  json.MergePatch(std::move(json["a"]));
+  EXPECT_EQ(json.ToString(), "{ \"a\": null, \"b\": 1, \"c\": 2, \"d\": 3, \"e\": 4 }");
+  json = Json::Parse("{\"x\": {\"x\": 5, \"z\": 6}}");
+  json.MergePatch(std::move(json["x"]));
+  EXPECT_EQ(json.ToString(), "{ \"x\": 5, \"z\": 6 }");
+  json.MergePatch(std::move(json));
+  EXPECT_EQ(json.ToString(), "{ \"x\": 5, \"z\": 6 }");
+}
+
+TEST_F(JsonTest, Equality) {
+  EXPECT_TRUE(Json::Parse("{\"a\": 1, \"b\": [true, null, \"x\"]}") == Json::Parse("{\"b\": [true, null, \"x\"], \"a\": 1.0}"));
+  EXPECT_TRUE(Json::Parse("[1, 2]") != Json::Parse("[2, 1]"));
+  EXPECT_TRUE(Json::Parse("{\"a\": 1}") != Json::Parse("{\"a\": 1, \"b\": 2}"));
+  EXPECT_TRUE(Json::Parse("{\"a\": 1}") != Json::Parse("{\"b\": 1}"));
+  EXPECT_TRUE(Json(int64_t(1) << 62) == Json(4611686018427387904.0));
+  EXPECT_TRUE(Json(uint64_t(18446744073709551615ULL)) != Json(18446744073709551616.0));
+  EXPECT_TRUE(Json(0.5) != Json(0));
+  EXPECT_TRUE(Json("1") != Json(1));
+  EXPECT_EQ(Json::Parse("{\"a\": 1, \"b\": {\"c\": [2]}}").Hash(), Json::Parse("{\"b\": {\"c\": [2.0]}, \"a\": 1}").Hash());
+  EXPECT_NE(Json::Parse("[1, 2]").Hash(), Json::Parse("[2, 1]").Hash());
+  EXPECT_NE(Json::Parse("{\"a\": 1, \"b\": 2}").Hash(), Json::Parse("{\"a\": 2, \"b\": 1}").Hash());
+
+  // the kept hashes follow the modifications
+  Json json = Json::Parse("{\"config\": {\"ports\": [80]}, \"name\": \"a\"}");
+  const Json snapshot = json;
+  const uint64_t hash = json.Hash();
+  json["config"]["ports"].Push(Json(443));
+  EXPECT_NE(json.Hash(), hash);
+  EXPECT_TRUE(json != snapshot);
+  Json& ports = json["config"]["ports"];
+  json.Hash();
+  ports[1] = 80;
+  ports.Remove(1);
+  EXPECT_EQ(json.Hash(), hash);
+  EXPECT_TRUE(json == snapshot);
+  EXPECT_EQ(snapshot.Hash(), hash);
+
+  std::unordered_set<Json> seen;
+  const char* documents[] = {"{\"id\": 1, \"tags\": [\"a\"]}", "{\"tags\": [\"a\"], \"id\": 1}", "[1]", "[1.0]", "{\"id\": 2}"};
+  for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) seen.insert(Json::Parse(documents[i]));
+  EXPECT_EQ(seen.size(), 3u);
+  EXPECT_EQ(seen.count(Json::Parse("{\"id\": 2}")), 1u);
+}
+
+TEST_F(JsonTest, BinaryFormats) {
+  const string document = "{\"id\": 9007199254740993, \"big\": 18446744073709551615, \"low\": -9223372036854775808,"
+                          " \"small\": [0, 127, 128, -1, -32, -33, -129, 65536, -40000, 4294967296], \"pi\": 3.14159, \"half\": 0.5,"
+                          " \"flags\": [true, false, null], \"name\": \"a string longer than fifteen\", \"empty\": {}, \"none\": [],"
+                          " \"nested\": {\"k\": [[], {\"deep\": \"x\"}]}}";
+  const Json json = Json::Parse(document.c_str());
+  std::string many;
+  for (int i = 0; i < 300; ++i) many += (i ? ", " : "") + std::to_string(i * 1000);
+  const Json large = Json::Parse(("[" + many + "]").c_str());
+  const Json values[] = {json, large, Json(), Json("x"), Json(1.5)};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    const string msgpack = values[i].ToMsgPack();
+    const string cbor = values[i].ToCbor();
+    EXPECT_TRUE(Json::FromMsgPack(msgpack.data(), msgpack.size()) == values[i]);
+    EXPECT_TRUE(Json::FromCbor(cbor.data(), cbor.size()) == values[i]);
+    EXPECT_EQ(Json::FromMsgPack(msgpack.data(), msgpack.size()).ToString(), values[i].ToString());
+    EXPECT_EQ(Json::FromCbor(cbor.data(), cbor.size()).ToString(), values[i].ToString());
+  }
+  EXPECT_LT(json.ToMsgPack().size(), json.ToString().size() * 2 / 3);
+
+  // the examples of the specifications
+  const string compact = Json::Parse("{\"compact\": true, \"schema\": 0}").ToMsgPack();
+  EXPECT_EQ(compact, string("\x82\xa7" "compact" "\xc3\xa6" "schema" "\x00", 18));
+  EXPECT_EQ(Json::Parse("{\"a\": 1, \"b\": [2, 3]}").ToCbor(), string("\xa2\x61" "a" "\x01\x61" "b" "\x82\x02\x03", 9));
+  EXPECT_EQ(Json(1000).ToCbor(), string("\x19\x03\xe8", 3));
+  EXPECT_EQ(Json(-1000).ToCbor(), string("\x39\x03\xe7", 3));
+  struct { const char* bytes; size_t size; const char* text; } cbor[] = {
+    {"\x9f\x01\x82\x02\x03\x9f\x04\x05\xff\xff", 10, "[ 1, [ 2, 3 ], [ 4, 5 ] ]"},
+    {"\xbf\x61" "a" "\x01\x61" "b" "\x9f\x02\x03\xff\xff", 11, "{ \"a\": 1, \"b\": [ 2, 3 ] }"},
+    {"\x7f\x65" "strea" "\x64" "ming" "\xff", 13, "\"streaming\""},
+    {"\xf9\xc4\x00", 3, "-4"},
+    {"\xf9\x3c\x00", 3, "1"},
+    {"\xc1\x1a\x51\x4b\x67\xb0", 6, "1363896240"},
+    {"\x3b\xff\xff\xff\xff\xff\xff\xff\xff", 9, "-18446744073709552000"},
+    {"\xf7", 1, "null"},
+  };
+  for (size_t i = 0; i < sizeof(cbor) / sizeof(cbor[0]); ++i) {
+    EXPECT_EQ(Json::FromCbor(cbor[i].bytes, cbor[i].size).ToString(), cbor[i].text);
+  }
+
+  // strings referenced in the bytes with kParseStringViews, copied out by a copy
+  string bytes = json.ToMsgPack();
+  Json view = Json::FromMsgPack(bytes.data(), bytes.size(), Json::kParseStringViews);
+  Json copy = view;
+  bytes.replace(bytes.find("a string"), 8, "A STRING");
+  EXPECT_EQ(view["name"].AsString(), "A STRING longer than fifteen");
+  EXPECT_EQ(copy["name"].AsString(), "a string longer than fifteen");
+
+  // cut, wrong or followed by more bytes
+  const string msgpack = json.ToMsgPack();
+  const string cbor_bytes = json.ToCbor();
+  for (size_t n = 0; n < msgpack.size(); ++n) EXPECT_THROW(Json::FromMsgPack(msgpack.data(), n), exception);
+  for (size_t n = 0; n < cbor_bytes.size(); ++n) EXPECT_THROW(Json::FromCbor(cbor_bytes.data(), n), exception);
+  EXPECT_THROW(Json::FromMsgPack((msgpack + '\xc0').data(), msgpack.size() + 1), exception);
+  EXPECT_THROW(Json::FromMsgPack("\xc1", 1), exception);
+  EXPECT_THROW(Json::FromMsgPack("\xd4\x01\x02", 3), exception);
+  EXPECT_THROW(Json::FromMsgPack("\x81\x01\x02", 3), exception);
+  EXPECT_THROW(Json::FromMsgPack("\xdd\xff\xff\xff\xff", 5), exception);
+  EXPECT_THROW(Json::FromCbor("\xa1\x01\x02", 3), exception);
+  EXPECT_THROW(Json::FromCbor("\xff", 1), exception);
+  EXPECT_THROW(Json::FromCbor("\x7f\x41" "a" "\xff", 4), exception);
+  EXPECT_THROW(Json::FromCbor("\x9f\x01", 2), exception);
+  // a definite length of all ones is not an indefinite length
+  EXPECT_THROW(Json::FromCbor("\x9b\xff\xff\xff\xff\xff\xff\xff\xff\x01\xff", 11), exception);
+  EXPECT_THROW(Json::FromCbor("\x7b\xff\xff\xff\xff\xff\xff\xff\xff\x61\x61\xff", 12), exception);
+}